@@ -8,6 +8,6 @@ SDL3INC = /usr/local/include/SDL3
 LIBEPOLLINC = /usr/local/include/libepoll-shim
 
 INCS = -I/usr/local/include -I${SDL3INC} -I${X11INC} -I${LIBEPOLLINC}
-LIBS = -L/usr/local/lib -lSDL3 -L${X11LIB} -lm
+LIBS = -L/usr/local/lib -lSDL3 -L${X11LIB} -lm -pthread
 CFLAGS = -D_REENTRANT ${INCS} -O3
 LDFLAGS = ${LIBS} 
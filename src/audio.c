@@ -1,68 +1,104 @@
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 #include <stdio.h>
-#include <math.h>
+#include <stdlib.h>
+#include <stdatomic.h>
 #include "types.h"
 #include "bitmath.h"
 #include "systems/system.h"
 #include "chips/2C02.h"
+#include "chips/2A03.h"
 #include "chips/6502.h"
 #include "systems/famicom.h"
+#include "palette.h"
 #include "graphics.h"
 #include "audio.h"
 
+// sdl's audio thread asks for more here
+static void audio_callback(void* userdata, SDL_AudioStream* stream, int additional, int total)
+{
+	Audio_ring* ring = userdata;
+	int16_t samples[AUDIO_RING];
+	int n = additional / sizeof(int16_t);
+	if (AUDIO_RING < n)
+		n = AUDIO_RING;
+	int got = audio_ring_pop(ring, samples, n);
+	for (int i=got; i<n; i++)
+		samples[i] = ring->last;
+	if (got != 0)
+		ring->last = samples[got - 1];
+	SDL_PutAudioStreamData(stream, samples, n * sizeof(int16_t));
+}
+
 void init_audio(SDL_Instance* g)
 {
 	SDL_AudioSpec spec;
 	spec.channels = 1;
 	spec.format = SDL_AUDIO_S16;
-	spec.freq = 16000;
-	SDL_AudioStream *stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, NULL, NULL);
+	spec.freq = APU_SAMPLE_RATE;
+	g->stream = NULL;
+	g->ring = calloc(1, sizeof(Audio_ring));
+	if (g->ring == NULL) {
+		printf("couldn't allocate memory\n");
+		return;
+	}
+	SDL_AudioStream *stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, audio_callback, g->ring);
 	if (stream == NULL) {
 		printf("failed to start audio: %s\n", SDL_GetError());
 	} else {
 		g->stream = stream;
-		//SDL_ResumeAudioStreamDevice(g->stream);
+		SDL_ResumeAudioStreamDevice(g->stream);
 	}
 }
 
-Sint16 format(double sample, double amplitude) {
-	// 32567 is the maximum value of a 16 bit signed integer (2^15-1)
-	return (Sint16)(sample*32567*amplitude);
-}
-
-double tone(double hz, unsigned long time) {
-	return sin(time * hz * M_PI * 2 / 16000);
+void audio_destroy(SDL_Instance* g)
+{
+	SDL_DestroyAudioStream(g->stream);
+	free(g->ring);
 }
 
-double square(double hz, unsigned long time) {
-	double sine = tone(hz, time);
-	return sine > 0.0 ? 1.0 : -1.0;
+// copies up to n samples in, returns how many fit
+int audio_ring_push(Audio_ring* ring, int16_t* samples, int n)
+{
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	uint32_t space = AUDIO_RING - (head - tail);
+	if (space < n)
+		n = space;
+	for (int i=0; i<n; i++)
+		ring->samples[(head + i) & (AUDIO_RING - 1)] = samples[i];
+	atomic_store_explicit(&ring->head, head + n, memory_order_release);
+	return n;
 }
 
-int get_freq(int value)
+// copies up to n samples out, returns how many there were
+int audio_ring_pop(Audio_ring* ring, int16_t* samples, int n)
 {
-	value = value & 0x0FFF;
-	value = reverse_byte_order(value);
-	return value;
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	uint32_t available = head - tail;
+	if (available < n)
+		n = available;
+	for (int i=0; i<n; i++)
+		samples[i] = ring->samples[(tail + i) & (AUDIO_RING - 1)];
+	atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+	return n;
 }
 
-// https://nesdev-wiki.nes.science/wikipages/Pulse_Channel_frequency_chart.xhtml
+// hands what the apu has made since last time to the ring. rather than drop
+// samples when we're ahead of the device or run dry when behind, the apu's
+// rate is moved up to AUDIO_RATE_RANGE away from the real one, in proportion
+// to how far the ring is from AUDIO_RING_TARGET.
 void apu_process(SDL_Instance* g, Famicom* famicom)
 {
-	Sint16 samples[16000];
-	int minimum_audio = (16000 * sizeof (Sint16));
-	if (SDL_GetAudioStreamQueued(g->stream) < minimum_audio) {
-		int i;
-		for (i = 0; i < SDL_arraysize(samples); i++) {
-			int freq1 = format(square(get_freq(famicom->apu.pulse1_timer), i), 0.1);
-			//int freq2 = format(square(get_freq(famicom->apu.pulse2_timer), i), 0.1);
-			//int freq3 = format(tone(famicom->apu.tri_timer / 5, i), 0.1);
-			samples[i] = freq1;// | freq2;// | freq3;
-		}
-	} else {
-		SDL_ClearAudioStream(g->stream);
-	}
-	SDL_PutAudioStreamData(g->stream, samples, sizeof (samples));
-	//SDL_FlushAudioStream(g->stream);
+	int16_t samples[APU_BUFFER];
+	int n = apu_take_samples(famicom->apu, samples, APU_BUFFER);
+	if (g->stream == NULL)
+		return;
+	audio_ring_push(g->ring, samples, n);
+	uint32_t filled = atomic_load_explicit(&g->ring->head, memory_order_relaxed) - atomic_load_explicit(&g->ring->tail, memory_order_relaxed);
+	double off = (double)((int)AUDIO_RING_TARGET - (int)filled) / AUDIO_RING_TARGET;
+	if (off < -1)
+		off = -1;
+	apu_set_rate(famicom->apu, APU_SAMPLE_RATE * (1 + AUDIO_RATE_RANGE * off));
 }
@@ -1,2 +1,18 @@
+#define AUDIO_RING 4096 // samples, a power of two
+#define AUDIO_RING_TARGET (AUDIO_RING / 2) // how full the producer keeps it, about 40 ms
+#define AUDIO_RATE_RANGE 0.005 // the most the apu's rate is moved by, either way
+
+// samples go from the emulation to sdl's audio thread through this, one side
+// only ever moves head and the other tail, so neither needs a lock
+typedef struct audio_ring {
+	int16_t samples[AUDIO_RING];
+	_Atomic uint32_t head; // written up to, by the producer
+	_Atomic uint32_t tail; // read up to, by sdl
+	int16_t last; // played again when it runs dry
+} Audio_ring;
+
 void init_audio(SDL_Instance* g);
+void audio_destroy(SDL_Instance* g);
+int audio_ring_push(Audio_ring* ring, int16_t* samples, int n);
+int audio_ring_pop(Audio_ring* ring, int16_t* samples, int n);
 void apu_process(SDL_Instance* g, Famicom* famicom);
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "types.h"
+#include "capture.h"
+
+#define CAPTURE_HEADER 44
+#define CAPTURE_CHUNK 2048 // samples converted at a time
+
+static void put16(byte* p, word v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32(byte* p, uint32_t v)
+{
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+static void write_header(Capture* c, int rate)
+{
+	byte h[CAPTURE_HEADER];
+	memcpy(h, "RIFF", 4);
+	put32(h + 4, 36 + c->samples * 2);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	put32(h + 16, 16);
+	put16(h + 20, 1); // pcm
+	put16(h + 22, 1); // mono
+	put32(h + 24, rate);
+	put32(h + 28, rate * 2);
+	put16(h + 32, 2);
+	put16(h + 34, 16);
+	memcpy(h + 36, "data", 4);
+	put32(h + 40, c->samples * 2);
+	fwrite(h, 1, CAPTURE_HEADER, c->f);
+}
+
+// with "-", stdout is kept for the samples and everything else printed goes
+// to stderr from then on
+Capture* capture_open(char* filename, int rate)
+{
+	Capture* c = malloc(sizeof(Capture));
+	if (c == NULL) {
+		printf("couldn't allocate memory\n");
+		return NULL;
+	}
+	c->samples = 0;
+	c->wav = strcmp(filename, "-") != 0;
+	if (c->wav) {
+		c->f = fopen(filename, "wb");
+	} else {
+		fflush(stdout);
+		int fd = dup(STDOUT_FILENO);
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+		c->f = fd < 0 ? NULL : fdopen(fd, "wb");
+	}
+	if (c->f == NULL) {
+		printf("couldn't open %s\n", filename);
+		free(c);
+		return NULL;
+	}
+	if (c->wav)
+		write_header(c, rate);
+	return c;
+}
+
+void capture_write(Capture* c, int16_t* samples, int n)
+{
+	byte out[CAPTURE_CHUNK * 2];
+	while (n != 0) {
+		int chunk = n < CAPTURE_CHUNK ? n : CAPTURE_CHUNK;
+		for (int i=0; i<chunk; i++)
+			put16(out + i * 2, samples[i]);
+		fwrite(out, 2, chunk, c->f);
+		samples += chunk;
+		n -= chunk;
+		c->samples += chunk;
+	}
+}
+
+void capture_close(Capture* c)
+{
+	if (c->wav) {
+		byte size[4];
+		put32(size, 36 + c->samples * 2);
+		fseek(c->f, 4, SEEK_SET);
+		fwrite(size, 1, 4, c->f);
+		put32(size, c->samples * 2);
+		fseek(c->f, 40, SEEK_SET);
+		fwrite(size, 1, 4, c->f);
+	}
+	fclose(c->f);
+	free(c);
+}
+
+// fnv-1a over the samples as little endian bytes, so hashes from different
+// hosts can be compared. start from CAPTURE_HASH_START.
+uint64_t capture_hash(uint64_t hash, int16_t* samples, int n)
+{
+	for (int i=0; i<n; i++) {
+		hash = (hash ^ (samples[i] & 0xFF)) * 0x100000001B3ULL;
+		hash = (hash ^ ((samples[i] >> 8) & 0xFF)) * 0x100000001B3ULL;
+	}
+	return hash;
+}
@@ -0,0 +1,16 @@
+// audio out of runs without sdl, for checking that they stay the same and
+// for processing in bulk. samples are written as a 16 bit mono wav file, or
+// as bare little endian pcm when the file is "-", which goes to stdout.
+
+#define CAPTURE_HASH_START 0xCBF29CE484222325ULL // fnv-1a's offset basis
+
+typedef struct capture {
+	FILE* f;
+	bool wav; // the header's sizes are filled in on close
+	uint32_t samples;
+} Capture;
+
+Capture* capture_open(char* filename, int rate);
+void capture_write(Capture* c, int16_t* samples, int n);
+void capture_close(Capture* c);
+uint64_t capture_hash(uint64_t hash, int16_t* samples, int n);
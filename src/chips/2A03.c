@@ -0,0 +1,533 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "../types.h"
+#include "2A03.h"
+
+static const byte length_table[32] = {
+	10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+	12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+static const byte duty_table[4][8] = {
+	{ 0, 1, 0, 0, 0, 0, 0, 0 },
+	{ 0, 1, 1, 0, 0, 0, 0, 0 },
+	{ 0, 1, 1, 1, 1, 0, 0, 0 },
+	{ 1, 0, 0, 1, 1, 1, 1, 1 },
+};
+
+static const byte triangle_table[32] = {
+	15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+};
+
+// in cpu cycles
+static const word noise_periods[16] = {
+	4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068,
+};
+
+static const word dmc_rates[16] = {
+	428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54,
+};
+
+#define BLIP_FULL ((uint64_t)APU_BUFFER << APU_BLIP_FRACTION)
+#define BLIP_CUTOFF 0.45 // of the sample rate, a little under half so the kernel can roll off
+
+// the mixer isn't linear, the pulses go through one dac and the rest through
+// another. indexed by the sum of the pulses, and by 3 triangle + 2 noise + dmc.
+static float pulse_mix[31];
+static float tnd_mix[203];
+// an impulse for each phase, summing to 1, that adds up to a band limited step
+static float blip_kernel[APU_BLIP_PHASES][APU_BLIP_TAPS];
+static pthread_once_t tables_built = PTHREAD_ONCE_INIT; // instances can be reset on several threads at once
+
+static void build_tables()
+{
+	pulse_mix[0] = 0;
+	for (int i=1; i<31; i++)
+		pulse_mix[i] = 95.52 / (8128.0 / i + 100);
+	tnd_mix[0] = 0;
+	for (int i=1; i<203; i++)
+		tnd_mix[i] = 163.67 / (24329.0 / i + 100);
+	for (int p=0; p<APU_BLIP_PHASES; p++) {
+		double sum = 0;
+		double k[APU_BLIP_TAPS];
+		for (int i=0; i<APU_BLIP_TAPS; i++) {
+			// from the middle of the kernel, windowed with a blackman window
+			double x = i - APU_BLIP_TAPS / 2 - (double)p / APU_BLIP_PHASES;
+			double sinc = x == 0 ? 1 : sin(M_PI * 2 * BLIP_CUTOFF * x) / (M_PI * 2 * BLIP_CUTOFF * x);
+			double w = 0.42 + 0.5 * cos(M_PI * 2 * x / APU_BLIP_TAPS) + 0.08 * cos(M_PI * 4 * x / APU_BLIP_TAPS);
+			k[i] = sinc * w;
+			sum += k[i];
+		}
+		for (int i=0; i<APU_BLIP_TAPS; i++)
+			blip_kernel[p][i] = k[i] / sum;
+	}
+}
+
+void apu_reset(Famicom_apu* apu, bool warm)
+{
+	pthread_once(&tables_built, build_tables);
+	if (!warm) {
+		memset(apu->pulse, 0, sizeof(apu->pulse));
+		memset(&apu->triangle, 0, sizeof(apu->triangle));
+		memset(&apu->noise, 0, sizeof(apu->noise));
+		memset(&apu->dmc, 0, sizeof(apu->dmc));
+		apu->pulse[0].ones_complement = true;
+		apu->noise.period = noise_periods[0];
+		apu->noise.timer = noise_periods[0];
+		apu->dmc.rate = dmc_rates[0];
+		apu->dmc.timer = dmc_rates[0];
+		apu->five_step = false;
+		apu->irq_inhibit = false;
+		apu->level = 0;
+		apu->blip_time = 0;
+		apu_set_rate(apu, APU_SAMPLE_RATE);
+		memset(apu->blip, 0, sizeof(apu->blip));
+		apu->integrator = 0;
+		apu->last_integrator = 0;
+		apu->highpass = 0;
+	}
+	// a reset silences everything, as if $4015 was written with 0
+	apu->enabled = 0;
+	for (int i=0; i<2; i++)
+		apu->pulse[i].length = 0;
+	apu->triangle.length = 0;
+	apu->noise.length = 0;
+	apu->noise.shift = 1;
+	apu->dmc.remaining = 0;
+	apu->dmc.bits = 8;
+	apu->dmc.silence = true;
+	apu->frame_irq = false;
+	apu->dmc_irq = false;
+	apu->frame_cycle = 0;
+	apu->odd_cycle = false;
+	apu->cycle = 0;
+	apu->changed = true;
+}
+
+static void clock_envelope(Apu_envelope* e)
+{
+	if (e->start) {
+		e->start = false;
+		e->decay = 15;
+		e->divider = e->period;
+	} else if (e->divider == 0) {
+		e->divider = e->period;
+		if (e->decay != 0)
+			e->decay--;
+		else if (e->loop)
+			e->decay = 15;
+	} else {
+		e->divider--;
+	}
+}
+
+static byte envelope_volume(Apu_envelope* e)
+{
+	return e->constant ? e->period : e->decay;
+}
+
+// where the sweep would take the period, pulses whose target is out of range
+// are muted whether the sweep is on or not
+static int sweep_target(Apu_pulse* p)
+{
+	int change = p->period >> p->sweep_shift;
+	if (p->sweep_negate)
+		return p->period - change - p->ones_complement;
+	return p->period + change;
+}
+
+static bool pulse_muted(Apu_pulse* p)
+{
+	return p->period < 8 || 0x7FF < sweep_target(p);
+}
+
+static void clock_sweep(Apu_pulse* p)
+{
+	if (p->sweep_divider == 0 && p->sweep_enabled && p->sweep_shift != 0 && !pulse_muted(p)) {
+		int target = sweep_target(p);
+		p->period = target < 0 ? 0 : target;
+	}
+	if (p->sweep_divider == 0 || p->sweep_reload) {
+		p->sweep_divider = p->sweep_period;
+		p->sweep_reload = false;
+	} else {
+		p->sweep_divider--;
+	}
+}
+
+static void quarter_frame(Famicom_apu* apu)
+{
+	apu->changed = true;
+	clock_envelope(&apu->pulse[0].envelope);
+	clock_envelope(&apu->pulse[1].envelope);
+	clock_envelope(&apu->noise.envelope);
+	Apu_triangle* t = &apu->triangle;
+	if (t->linear_reload)
+		t->linear = t->linear_period;
+	else if (t->linear != 0)
+		t->linear--;
+	if (!t->control)
+		t->linear_reload = false;
+}
+
+static void half_frame(Famicom_apu* apu)
+{
+	apu->changed = true;
+	for (int i=0; i<2; i++) {
+		Apu_pulse* p = &apu->pulse[i];
+		if (!p->envelope.loop && p->length != 0)
+			p->length--;
+		clock_sweep(p);
+	}
+	if (!apu->triangle.control && apu->triangle.length != 0)
+		apu->triangle.length--;
+	if (!apu->noise.envelope.loop && apu->noise.length != 0)
+		apu->noise.length--;
+}
+
+static void clock_frame_counter(Famicom_apu* apu)
+{
+	apu->frame_cycle++;
+	switch (apu->frame_cycle) {
+	case 7457:
+	case 22371:
+		quarter_frame(apu);
+		break;
+	case 14913:
+		quarter_frame(apu);
+		half_frame(apu);
+		break;
+	case APU_FRAME_IRQ:
+		if (!apu->five_step) {
+			quarter_frame(apu);
+			half_frame(apu);
+			if (!apu->irq_inhibit)
+				apu->frame_irq = true;
+		}
+		break;
+	case APU_FRAME_4_STEP:
+		if (!apu->five_step)
+			apu->frame_cycle = 0;
+		break;
+	case APU_FRAME_5_STEP - 1:
+		quarter_frame(apu);
+		half_frame(apu);
+		break;
+	case APU_FRAME_5_STEP:
+		apu->frame_cycle = 0;
+		break;
+	}
+}
+
+static void dmc_restart(Apu_dmc* d)
+{
+	d->address = d->sample_address;
+	d->remaining = d->sample_length;
+}
+
+// the reader fills the buffer as soon as it's empty
+static void dmc_fetch(Famicom_apu* apu)
+{
+	Apu_dmc* d = &apu->dmc;
+	if (d->buffer_full || d->remaining == 0)
+		return;
+	d->buffer = apu->read(apu->machine, d->address);
+	d->buffer_full = true;
+	d->address = d->address == 0xFFFF ? 0x8000 : d->address + 1;
+	d->remaining--;
+	if (d->remaining == 0) {
+		if (d->loop)
+			dmc_restart(d);
+		else if (d->irq_enabled)
+			apu->dmc_irq = true;
+	}
+}
+
+static void clock_dmc(Famicom_apu* apu)
+{
+	Apu_dmc* d = &apu->dmc;
+	if (--d->timer != 0)
+		return;
+	d->timer = d->rate;
+	if (!d->silence) {
+		apu->changed = true;
+		if (d->shift & 1) {
+			if (d->output <= 125)
+				d->output += 2;
+		} else if (2 <= d->output) {
+			d->output -= 2;
+		}
+	}
+	d->shift >>= 1;
+	if (--d->bits == 0) {
+		d->bits = 8;
+		d->silence = !d->buffer_full;
+		if (d->buffer_full) {
+			d->shift = d->buffer;
+			d->buffer_full = false;
+			dmc_fetch(apu);
+		}
+	}
+}
+
+static void mix(Famicom_apu* apu)
+{
+	byte pulses = 0;
+	for (int i=0; i<2; i++) {
+		Apu_pulse* p = &apu->pulse[i];
+		if (p->length != 0 && !pulse_muted(p) && duty_table[p->duty][p->step])
+			pulses += envelope_volume(&p->envelope);
+	}
+	byte triangle = triangle_table[apu->triangle.step];
+	byte noise = apu->noise.length != 0 && !(apu->noise.shift & 1) ? envelope_volume(&apu->noise.envelope) : 0;
+	float level = pulse_mix[pulses] + tnd_mix[3 * triangle + 2 * noise + apu->dmc.output];
+	float delta = level - apu->level;
+	if (delta == 0)
+		return;
+	apu->level = level;
+	float* out = apu->blip + (apu->blip_time >> APU_BLIP_FRACTION);
+	uint64_t fraction = apu->blip_time & ((1ULL << APU_BLIP_FRACTION) - 1);
+	float* kernel = blip_kernel[fraction * APU_BLIP_PHASES >> APU_BLIP_FRACTION];
+	for (int i=0; i<APU_BLIP_TAPS; i++)
+		out[i] += delta * kernel[i];
+}
+
+// sums n finished samples out of blip, through the high-pass, into samples,
+// or nowhere if it's NULL
+static void read_samples(Famicom_apu* apu, int16_t* samples, int n)
+{
+	for (int i=0; i<n; i++) {
+		apu->integrator += apu->blip[i];
+		apu->highpass = APU_HIGHPASS * (apu->highpass + apu->integrator - apu->last_integrator);
+		apu->last_integrator = apu->integrator;
+		if (samples != NULL) {
+			int sample = apu->highpass * APU_VOLUME;
+			if (sample < -32768)
+				sample = -32768;
+			if (32767 < sample)
+				sample = 32767;
+			samples[i] = sample;
+		}
+	}
+	int left = (apu->blip_time >> APU_BLIP_FRACTION) - n + APU_BLIP_TAPS;
+	memmove(apu->blip, apu->blip + n, left * sizeof(float));
+	memset(apu->blip + left, 0, n * sizeof(float));
+	apu->blip_time -= (uint64_t)n << APU_BLIP_FRACTION;
+}
+
+// runs every cycle up to the cpu's
+void apu_run(Famicom_apu* apu, uint64_t cycle)
+{
+	for (; apu->cycle < cycle; apu->cycle++, apu->blip_time += apu->blip_cycle) {
+		clock_frame_counter(apu);
+		apu->odd_cycle = !apu->odd_cycle;
+		if (apu->odd_cycle) {
+			for (int i=0; i<2; i++) {
+				Apu_pulse* p = &apu->pulse[i];
+				if (p->timer == 0) {
+					p->timer = p->period;
+					p->step = (p->step + 1) & 0x07;
+					apu->changed = true;
+				} else {
+					p->timer--;
+				}
+			}
+		}
+		Apu_triangle* t = &apu->triangle;
+		if (t->timer == 0) {
+			t->timer = t->period;
+			if (t->length != 0 && t->linear != 0) {
+				t->step = (t->step + 1) & 0x1F;
+				apu->changed = true;
+			}
+		} else {
+			t->timer--;
+		}
+		Apu_noise* n = &apu->noise;
+		if (--n->timer == 0) {
+			n->timer = n->period;
+			word feedback = (n->shift ^ (n->shift >> (n->mode ? 6 : 1))) & 1;
+			n->shift = n->shift >> 1 | feedback << 14;
+			apu->changed = true;
+		}
+		clock_dmc(apu);
+		// with nobody taking them, the oldest samples are dropped
+		if (BLIP_FULL <= apu->blip_time)
+			read_samples(apu, NULL, APU_BUFFER);
+		if (apu->changed) {
+			apu->changed = false;
+			mix(apu);
+		}
+	}
+}
+
+static void write_length(Famicom_apu* apu, int channel, byte* length, byte value)
+{
+	if (apu->enabled & 1 << channel)
+		*length = length_table[value >> 3];
+}
+
+// $4000-$4013, $4015 and $4017
+void apu_write(Famicom_apu* apu, word addr, byte value)
+{
+	apu->changed = true;
+	if (addr < 0x4008) {
+		Apu_pulse* p = &apu->pulse[(addr >> 2) & 1];
+		switch (addr & 0x03) {
+		case 0:
+			p->duty = value >> 6;
+			p->envelope.loop = value & 0x20;
+			p->envelope.constant = value & 0x10;
+			p->envelope.period = value & 0x0F;
+			break;
+		case 1:
+			p->sweep_enabled = value & 0x80;
+			p->sweep_period = (value >> 4) & 0x07;
+			p->sweep_negate = value & 0x08;
+			p->sweep_shift = value & 0x07;
+			p->sweep_reload = true;
+			break;
+		case 2:
+			p->period = (p->period & 0x700) | value;
+			break;
+		case 3:
+			p->period = (p->period & 0xFF) | (value & 0x07) << 8;
+			write_length(apu, (addr >> 2) & 1, &p->length, value);
+			p->step = 0;
+			p->envelope.start = true;
+			break;
+		}
+		return;
+	}
+	Apu_triangle* t = &apu->triangle;
+	Apu_noise* n = &apu->noise;
+	Apu_dmc* d = &apu->dmc;
+	switch (addr) {
+	case 0x4008:
+		t->control = value & 0x80;
+		t->linear_period = value & 0x7F;
+		break;
+	case 0x400A:
+		t->period = (t->period & 0x700) | value;
+		break;
+	case 0x400B:
+		t->period = (t->period & 0xFF) | (value & 0x07) << 8;
+		write_length(apu, 2, &t->length, value);
+		t->linear_reload = true;
+		break;
+	case 0x400C:
+		n->envelope.loop = value & 0x20;
+		n->envelope.constant = value & 0x10;
+		n->envelope.period = value & 0x0F;
+		break;
+	case 0x400E:
+		n->mode = value & 0x80;
+		n->period = noise_periods[value & 0x0F];
+		break;
+	case 0x400F:
+		write_length(apu, 3, &n->length, value);
+		n->envelope.start = true;
+		break;
+	case 0x4010:
+		d->irq_enabled = value & 0x80;
+		d->loop = value & 0x40;
+		d->rate = dmc_rates[value & 0x0F];
+		if (!d->irq_enabled)
+			apu->dmc_irq = false;
+		break;
+	case 0x4011:
+		d->output = value & 0x7F;
+		break;
+	case 0x4012:
+		d->sample_address = 0xC000 | value << 6;
+		break;
+	case 0x4013:
+		d->sample_length = value << 4 | 1;
+		break;
+	case 0x4015:
+		apu->enabled = value & 0x1F;
+		if (!(value & 0x01))
+			apu->pulse[0].length = 0;
+		if (!(value & 0x02))
+			apu->pulse[1].length = 0;
+		if (!(value & 0x04))
+			t->length = 0;
+		if (!(value & 0x08))
+			n->length = 0;
+		if (!(value & 0x10)) {
+			d->remaining = 0;
+		} else if (d->remaining == 0) {
+			dmc_restart(d);
+			dmc_fetch(apu);
+		}
+		apu->dmc_irq = false;
+		break;
+	case 0x4017:
+		// the sequence restarts straight away, not 3 or 4 cycles later
+		apu->five_step = value & 0x80;
+		apu->irq_inhibit = value & 0x40;
+		if (apu->irq_inhibit)
+			apu->frame_irq = false;
+		apu->frame_cycle = 0;
+		if (apu->five_step) {
+			quarter_frame(apu);
+			half_frame(apu);
+		}
+		break;
+	}
+}
+
+byte apu_read_status(Famicom_apu* apu)
+{
+	byte status = (apu->pulse[0].length != 0)
+	    | (apu->pulse[1].length != 0) << 1
+	    | (apu->triangle.length != 0) << 2
+	    | (apu->noise.length != 0) << 3
+	    | (apu->dmc.remaining != 0 ? APU_STATUS_DMC : 0)
+	    | (apu->frame_irq ? APU_STATUS_FRAME_IRQ : 0)
+	    | (apu->dmc_irq ? APU_STATUS_DMC_IRQ : 0);
+	apu->frame_irq = false;
+	return status;
+}
+
+// the cycle the frame irq will be set on if nothing is written before then,
+// UINT64_MAX if it won't be
+uint64_t apu_frame_irq_at(Famicom_apu* apu)
+{
+	if (apu->five_step || apu->irq_inhibit || apu->frame_irq)
+		return UINT64_MAX;
+	if (apu->frame_cycle < APU_FRAME_IRQ)
+		return apu->cycle + APU_FRAME_IRQ - apu->frame_cycle;
+	return apu->cycle + APU_FRAME_4_STEP - apu->frame_cycle + APU_FRAME_IRQ;
+}
+
+// the same for the dmc, whose irq comes with reading the last byte of the
+// sample. the buffer is always full while there's more to read, the next read
+// is when the output unit takes it, and every 8 timer clocks after that.
+uint64_t apu_dmc_irq_at(Famicom_apu* apu)
+{
+	Apu_dmc* d = &apu->dmc;
+	if (!d->irq_enabled || d->loop || d->remaining == 0 || apu->dmc_irq)
+		return UINT64_MAX;
+	return apu->cycle + d->timer + (uint64_t)(d->bits - 1) * d->rate + (uint64_t)(d->remaining - 1) * 8 * d->rate;
+}
+
+// sums up to max of the finished samples, returns how many
+int apu_take_samples(Famicom_apu* apu, int16_t* samples, int max)
+{
+	int n = apu->blip_time >> APU_BLIP_FRACTION;
+	if (max < n)
+		n = max;
+	read_samples(apu, samples, n);
+	return n;
+}
+
+// the samples a second it makes. whoever plays them can nudge this to keep up
+// with a device whose clock isn't quite the same as ours.
+void apu_set_rate(Famicom_apu* apu, double rate)
+{
+	apu->blip_cycle = rate / APU_CLOCK * (1ULL << APU_BLIP_FRACTION);
+}
@@ -0,0 +1,122 @@
+// the audio half of the 2A03: two pulse channels, a triangle, noise, and the
+// delta modulation channel, which plays samples it reads from the cpu's bus.
+// it counts in cpu cycles and is only run when something needs it caught up,
+// with apu_run(). the frame counter and dmc irqs can be predicted from its
+// state, so the cpu can still see them on the right cycle.
+// the output is made blip_buf's way. each change of the mixer's level is added
+// to a buffer at the time it happened, as the difference of a band limited
+// step, and the buffer is summed up into samples when they're taken.
+
+#define APU_CLOCK 1789773 // ntsc cpu cycles a second
+#define APU_SAMPLE_RATE 48000
+#define APU_BUFFER 8192 // samples kept until they're taken
+#define APU_FRAME_IRQ 29829 // the cycle of the 4 step sequence that sets the frame irq
+#define APU_FRAME_4_STEP 29830
+#define APU_FRAME_5_STEP 37282
+#define APU_HIGHPASS 0.988 // the famicom's output is ac coupled, this is about 90 Hz at APU_SAMPLE_RATE
+#define APU_VOLUME 30000
+#define APU_BLIP_PHASES 32 // where between two samples a step can start
+#define APU_BLIP_TAPS 16 // samples a step is spread over, it's heard half of them late
+#define APU_BLIP_FRACTION 32 // bits of blip_time below a whole sample
+
+#define APU_STATUS_DMC 0x10
+#define APU_STATUS_FRAME_IRQ 0x40
+#define APU_STATUS_DMC_IRQ 0x80
+
+typedef struct apu_envelope {
+	bool start;
+	bool loop; // also halts the length counter
+	bool constant;
+	byte period; // the volume, when it's constant
+	byte divider;
+	byte decay;
+} Apu_envelope;
+
+typedef struct apu_pulse {
+	Apu_envelope envelope;
+	byte duty;
+	byte step;
+	word period; // in apu cycles, two cpu cycles each
+	word timer;
+	byte length;
+	bool sweep_enabled;
+	bool sweep_negate;
+	bool sweep_reload;
+	byte sweep_period;
+	byte sweep_shift;
+	byte sweep_divider;
+	bool ones_complement; // pulse 1 subtracts one more when sweeping down
+} Apu_pulse;
+
+typedef struct apu_triangle {
+	bool control; // halts the length counter and keeps reloading the linear one
+	byte linear_period;
+	byte linear;
+	bool linear_reload;
+	word period;
+	word timer;
+	byte step;
+	byte length;
+} Apu_triangle;
+
+typedef struct apu_noise {
+	Apu_envelope envelope;
+	bool mode; // taps bit 6 instead of bit 1, for the short sequence
+	word period;
+	word timer;
+	word shift;
+	byte length;
+} Apu_noise;
+
+typedef struct apu_dmc {
+	bool irq_enabled;
+	bool loop;
+	word rate;
+	word timer;
+	byte output; // 7 bits
+	word sample_address;
+	word sample_length;
+	word address; // of the next byte to read
+	word remaining; // bytes of the sample left to read
+	byte buffer;
+	bool buffer_full;
+	byte shift;
+	byte bits; // left in shift
+	bool silence;
+} Apu_dmc;
+
+typedef struct apu {
+	Apu_pulse pulse[2];
+	Apu_triangle triangle;
+	Apu_noise noise;
+	Apu_dmc dmc;
+	byte enabled; // the channel bits of $4015
+	bool five_step;
+	bool irq_inhibit;
+	bool frame_irq;
+	bool dmc_irq;
+	int frame_cycle; // into the frame counter's sequence
+	bool odd_cycle; // the pulse timers only count on every other cycle
+	uint64_t cycle; // the cpu cycle it's been run up to
+	// the dmc's reads go through the cpu's bus
+	void* machine;
+	byte (*read)(void* machine, word addr);
+	// the mixer's level is only worked out again when something has changed
+	bool changed;
+	float level;
+	uint64_t blip_time; // where cycle is in blip, in samples
+	uint64_t blip_cycle; // a cycle in samples, see apu_set_rate()
+	float blip[APU_BUFFER + APU_BLIP_TAPS];
+	float integrator;
+	float last_integrator;
+	float highpass;
+} Famicom_apu;
+
+void apu_reset(Famicom_apu* apu, bool warm);
+void apu_write(Famicom_apu* apu, word addr, byte value);
+byte apu_read_status(Famicom_apu* apu);
+void apu_run(Famicom_apu* apu, uint64_t cycle);
+uint64_t apu_frame_irq_at(Famicom_apu* apu);
+uint64_t apu_dmc_irq_at(Famicom_apu* apu);
+int apu_take_samples(Famicom_apu* apu, int16_t* samples, int max);
+void apu_set_rate(Famicom_apu* apu, double rate);
@@ -0,0 +1,512 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../types.h"
+#include "2C02.h"
+#include "2C02_kernels.h"
+
+static void cache_invalidate(Famicom_ppu* ppu)
+{
+	memset(ppu->cache_dirty, 0xFF, sizeof(ppu->cache_dirty));
+}
+
+// marks what a write to a byte of a nametable changes, a tile, or the 4x4
+// tiles under an attribute byte
+static void cache_mark(Famicom_ppu* ppu, int page, word offset)
+{
+	if (offset < 0x3C0) {
+		ppu->cache_dirty[page][offset >> 5] |= 1u << (offset & 0x1F);
+		return;
+	}
+	int row = ((offset - 0x3C0) >> 3) * 4;
+	uint32_t columns = 0x0Fu << ((offset & 0x07) * 4);
+	for (int y=row; y<row+4 && y<PPU_CACHE_ROWS; y++)
+		ppu->cache_dirty[page][y] |= columns;
+}
+
+void ppu_reset(Famicom_ppu* ppu, bool warm)
+{
+	if (!warm) {
+		memset(ppu->ciram, 0, sizeof(ppu->ciram));
+		cache_invalidate(ppu);
+		memset(ppu->palettes, 0, sizeof(ppu->palettes));
+		memset(ppu->oam, 0, sizeof(ppu->oam));
+		ppu->status = 0;
+		ppu->oam_address = 0;
+		ppu->v = 0;
+		ppu->t = 0;
+		ppu->x = 0;
+	}
+	ppu->ctrl = 0;
+	ppu->mask = 0;
+	ppu->w = false;
+	ppu->line_v = 0;
+	ppu->sprites_found = 0;
+	ppu->sprite_zero_found = false;
+	memset(ppu->sprite_line, 0, sizeof(ppu->sprite_line));
+	ppu->sprite0_dot = -1;
+	ppu->read_buffer = 0;
+	ppu->latch = 0;
+	ppu->dot = 0;
+	ppu->scanline = 0;
+	ppu->odd_frame = false;
+	ppu->frame = 0;
+	ppu->kernels = ppu_kernels_best();
+}
+
+void ppu_set_mirroring(Famicom_ppu* ppu, enum ppu_mirroring mirroring)
+{
+	// which 1 KB of ciram each of $2000, $2400, $2800 and $2C00 is
+	static const byte pages[5][4] = {
+		[mirroring_horizontal] = { 0, 0, 1, 1 },
+		[mirroring_vertical] = { 0, 1, 0, 1 },
+		[mirroring_single_a] = { 0, 0, 0, 0 },
+		[mirroring_single_b] = { 1, 1, 1, 1 },
+		[mirroring_four_screen] = { 0, 1, 2, 3 },
+	};
+	for (int i=0; i<4; i++) {
+		ppu->nametables[i] = ppu->ciram + pages[mirroring][i] * 0x400;
+		ppu->nametable_pages[i] = pages[mirroring][i];
+	}
+}
+
+// maps 8 KB of chr to the pattern tables, writable for chr ram
+void ppu_set_chr(Famicom_ppu* ppu, byte* chr, bool writable)
+{
+	for (int i=0; i<8; i++)
+		ppu->pattern[i] = chr + i * 0x400;
+	ppu->chr_writable = writable;
+	cache_invalidate(ppu);
+}
+
+// turns drawing the background from a cache of the nametables on or off, false
+// if it couldn't be allocated
+bool ppu_cache_background(Famicom_ppu* ppu, bool enable)
+{
+	if (!enable) {
+		free(ppu->cache);
+		ppu->cache = NULL;
+		return true;
+	}
+	if (ppu->cache == NULL) {
+		ppu->cache = malloc(4 * sizeof(*ppu->cache));
+		if (ppu->cache == NULL) {
+			printf("couldn't allocate memory\n");
+			return false;
+		}
+	}
+	ppu->cache_table = ppu->ctrl & PPUCTRL_BG_TABLE;
+	cache_invalidate(ppu);
+	return true;
+}
+
+// $3F10, $3F14, $3F18 and $3F1C are the same entries as $3F00, $3F04, ...
+static byte palette_index(word addr)
+{
+	addr &= 0x1F;
+	if ((addr & 0x13) == 0x10)
+		addr &= 0x0F;
+	return addr;
+}
+
+byte ppu_read(Famicom_ppu* ppu, word addr)
+{
+	addr &= 0x3FFF;
+	if (addr < 0x2000)
+		return ppu->pattern[addr >> 10][addr & 0x3FF];
+	if (addr < 0x3F00)
+		return ppu->nametables[(addr >> 10) & 0x03][addr & 0x3FF];
+	return ppu->palettes[palette_index(addr)];
+}
+
+void ppu_write(Famicom_ppu* ppu, word addr, byte value)
+{
+	addr &= 0x3FFF;
+	if (addr < 0x2000) {
+		if (ppu->chr_writable) {
+			ppu->pattern[addr >> 10][addr & 0x3FF] = value;
+			// any tile could be using it
+			if (ppu->cache != NULL)
+				cache_invalidate(ppu);
+		}
+	} else if (addr < 0x3F00) {
+		int nametable = (addr >> 10) & 0x03;
+		ppu->nametables[nametable][addr & 0x3FF] = value;
+		if (ppu->cache != NULL)
+			cache_mark(ppu, ppu->nametable_pages[nametable], addr & 0x3FF);
+	} else {
+		ppu->palettes[palette_index(addr)] = value & 0x3F;
+	}
+}
+
+byte ppu_read_register(Famicom_ppu* ppu, byte reg)
+{
+	byte value;
+	switch (reg) {
+	case PPUSTATUS:
+		value = ppu->status | (ppu->latch & 0x1F);
+		ppu->status &= ~PPUSTATUS_VBLANK;
+		ppu->w = false;
+		break;
+	case OAMDATA:
+		value = ((byte*)ppu->oam)[ppu->oam_address];
+		// the attribute bits that don't exist read back as 0
+		if ((ppu->oam_address & 0x03) == 2)
+			value &= 0xE3;
+		break;
+	case PPUDATA:
+		if ((ppu->v & 0x3FFF) < 0x3F00) {
+			value = ppu->read_buffer;
+			ppu->read_buffer = ppu_read(ppu, ppu->v);
+		} else {
+			// palettes are read straight away, the buffer gets the nametable under them
+			value = ppu_read(ppu, ppu->v) | (ppu->latch & 0xC0);
+			ppu->read_buffer = ppu_read(ppu, ppu->v - 0x1000);
+		}
+		ppu->v = (ppu->v + (ppu->ctrl & PPUCTRL_INCREMENT ? 32 : 1)) & 0x7FFF;
+		break;
+	default:
+		// write only
+		return ppu->latch;
+	}
+	ppu->latch = value;
+	return value;
+}
+
+void ppu_write_register(Famicom_ppu* ppu, byte reg, byte value)
+{
+	ppu->latch = value;
+	switch (reg) {
+	case PPUCTRL:
+		ppu->ctrl = value;
+		ppu->t = (ppu->t & ~0x0C00) | (value & PPUCTRL_NAMETABLE) << 10;
+		break;
+	case PPUMASK:
+		ppu->mask = value;
+		break;
+	case OAMADDR:
+		ppu->oam_address = value;
+		break;
+	case OAMDATA:
+		((byte*)ppu->oam)[ppu->oam_address++] = value;
+		break;
+	case PPUSCROLL:
+		if (!ppu->w) {
+			ppu->t = (ppu->t & ~0x001F) | value >> 3;
+			ppu->x = value & 0x07;
+		} else {
+			ppu->t = (ppu->t & ~0x73E0) | (value & 0x07) << 12 | (value & 0xF8) << 2;
+		}
+		ppu->w = !ppu->w;
+		break;
+	case PPUADDR:
+		if (!ppu->w) {
+			ppu->t = (ppu->t & 0x00FF) | (value & 0x3F) << 8;
+		} else {
+			ppu->t = (ppu->t & 0x7F00) | value;
+			ppu->v = ppu->t;
+		}
+		ppu->w = !ppu->w;
+		break;
+	case PPUDATA:
+		ppu_write(ppu, ppu->v, value);
+		ppu->v = (ppu->v + (ppu->ctrl & PPUCTRL_INCREMENT ? 32 : 1)) & 0x7FFF;
+		break;
+	}
+}
+
+// the level of the ppu's nmi output
+bool ppu_nmi(Famicom_ppu* ppu)
+{
+	return ppu->status & ppu->ctrl & PPUCTRL_NMI;
+}
+
+// v is laid out as yyy NN YYYYY XXXXX: fine y, nametable, coarse y and coarse x
+static void increment_coarse_x(Famicom_ppu* ppu)
+{
+	if ((ppu->v & 0x001F) == 31) {
+		ppu->v &= ~0x001F;
+		ppu->v ^= 0x0400;
+	} else {
+		ppu->v++;
+	}
+}
+
+static void increment_y(Famicom_ppu* ppu)
+{
+	if ((ppu->v & 0x7000) != 0x7000) {
+		ppu->v += 0x1000;
+		return;
+	}
+	ppu->v &= ~0x7000;
+	int coarse_y = (ppu->v & 0x03E0) >> 5;
+	if (coarse_y == 29) {
+		coarse_y = 0;
+		ppu->v ^= 0x0800;
+	} else if (coarse_y == 31) {
+		// the attribute rows wrap without switching nametables
+		coarse_y = 0;
+	} else {
+		coarse_y++;
+	}
+	ppu->v = (ppu->v & ~0x03E0) | coarse_y << 5;
+}
+
+// the line starts at the scroll v had at the end of the last one, and crosses
+// into the next nametable over after 32 tiles
+static void background_from_tiles(Famicom_ppu* ppu, byte* line)
+{
+	word v = ppu->line_v;
+	int coarse_y = (v >> 5) & 0x1F;
+	word pattern_base = (ppu->ctrl & PPUCTRL_BG_TABLE) << 8 | v >> 12;
+	// 33 tiles, as fine x scrolls part of one more in
+	byte low[PPU_LINE_TILES], high[PPU_LINE_TILES], palette[PPU_LINE_TILES];
+	for (int tile=0; tile<PPU_LINE_TILES; tile++) {
+		int coarse_x = (v & 0x001F) + tile;
+		byte* table = ppu->nametables[((v >> 10) & 0x03) ^ ((coarse_x >> 5) & 0x01)];
+		coarse_x &= 0x1F;
+		byte name = table[coarse_y * 32 + coarse_x];
+		byte attribute = table[0x3C0 + (coarse_y >> 2) * 8 + (coarse_x >> 2)];
+		palette[tile] = (attribute >> ((coarse_y & 0x02) << 1 | (coarse_x & 0x02)) & 0x03) << 2;
+		word addr = pattern_base | name << 4;
+		byte* row = ppu->pattern[addr >> 10] + (addr & 0x3FF);
+		low[tile] = row[0];
+		high[tile] = row[8];
+	}
+	byte pixels[PPU_LINE_TILES * 8];
+	ppu->kernels->expand(low, high, palette, PPU_LINE_TILES, false, pixels);
+	memcpy(line, pixels + ppu->x, PPU_WIDTH);
+}
+
+// draws again the tiles of a row of the cache that have changed
+static void cache_row(Famicom_ppu* ppu, int page, int coarse_y)
+{
+	uint32_t dirty = ppu->cache_dirty[page][coarse_y];
+	if (dirty == 0)
+		return;
+	ppu->cache_dirty[page][coarse_y] = 0;
+	byte* table = ppu->ciram + page * 0x400;
+	word pattern_base = (ppu->ctrl & PPUCTRL_BG_TABLE) << 8;
+	for (int coarse_x=0; coarse_x<32; coarse_x++) {
+		if (!(dirty & 1u << coarse_x))
+			continue;
+		byte name = table[coarse_y * 32 + coarse_x];
+		byte attribute = table[0x3C0 + (coarse_y >> 2) * 8 + (coarse_x >> 2)];
+		byte palette[8];
+		memset(palette, (attribute >> ((coarse_y & 0x02) << 1 | (coarse_x & 0x02)) & 0x03) << 2, 8);
+		word addr = pattern_base | name << 4;
+		byte* rows = ppu->pattern[addr >> 10] + (addr & 0x3FF);
+		// the tile's 8 rows go through the kernel as if they were 8 tiles of a line
+		byte pixels[64];
+		ppu->kernels->expand(rows, rows + 8, palette, 8, false, pixels);
+		for (int y=0; y<8; y++)
+			memcpy(&ppu->cache[page][coarse_y * 8 + y][coarse_x * 8], pixels + y * 8, 8);
+	}
+}
+
+static void background_from_cache(Famicom_ppu* ppu, byte* line)
+{
+	word v = ppu->line_v;
+	if ((ppu->ctrl & PPUCTRL_BG_TABLE) != ppu->cache_table) {
+		ppu->cache_table = ppu->ctrl & PPUCTRL_BG_TABLE;
+		cache_invalidate(ppu);
+	}
+	int coarse_y = (v >> 5) & 0x1F;
+	int y = coarse_y * 8 + (v >> 12);
+	int x = (v & 0x001F) * 8 + ppu->x;
+	int left = ppu->nametable_pages[(v >> 10) & 0x03];
+	int right = ppu->nametable_pages[((v >> 10) & 0x03) ^ 0x01];
+	cache_row(ppu, left, coarse_y);
+	cache_row(ppu, right, coarse_y);
+	memcpy(line, &ppu->cache[left][y][x], PPU_WIDTH - x);
+	memcpy(line + PPU_WIDTH - x, ppu->cache[right][y], x);
+}
+
+// the background's palette entries for the line, 0 being the backdrop
+static void render_background(Famicom_ppu* ppu, byte* line)
+{
+	if (!(ppu->mask & PPUMASK_BG)) {
+		memset(line, 0, PPU_WIDTH);
+		return;
+	}
+	// the cache only has the tile rows, not the attributes v can scroll into
+	if (ppu->cache != NULL && ((ppu->line_v >> 5) & 0x1F) < PPU_CACHE_ROWS)
+		background_from_cache(ppu, line);
+	else
+		background_from_tiles(ppu, line);
+	if (!(ppu->mask & PPUMASK_BG_LEFT))
+		memset(line, 0, 8);
+}
+
+// puts the row of a sprite in secondary oam that the next line goes through
+// into the sprite line buffer
+static void decode_sprite(Famicom_ppu* ppu, int i, int height)
+{
+	byte* sprite = ppu->secondary_oam[i];
+	byte attributes = sprite[2];
+	int row = ppu->scanline - sprite[0];
+	if (attributes & 0x80)
+		row = height - 1 - row;
+	word addr;
+	if (height == 16)
+		addr = (sprite[1] & 0x01) << 12 | (sprite[1] & 0xFE) << 4 | (row & 0x08) << 1 | (row & 0x07);
+	else
+		addr = (ppu->ctrl & PPUCTRL_SPRITE_TABLE) << 9 | sprite[1] << 4 | row;
+	byte* pattern = ppu->pattern[addr >> 10] + (addr & 0x3FF);
+	byte flags = 0x10 | (attributes & 0x03) << 2;
+	if (attributes & 0x20)
+		flags |= PPU_SPRITE_BEHIND;
+	if (i == 0 && ppu->sprite_zero_found)
+		flags |= PPU_SPRITE_ZERO;
+	byte pixels[8];
+	ppu->kernels->expand(pattern, pattern + 8, &flags, 1, attributes & 0x40, pixels);
+	for (int x=0; x<8 && sprite[3] + x < PPU_WIDTH; x++) {
+		if (pixels[x])
+			ppu->sprite_line[sprite[3] + x] = pixels[x];
+	}
+}
+
+// finds the first eight sprites on the next line and decodes them, what the
+// ppu spreads over dots 65 to 320. the overflow flag is set for a ninth,
+// without the hardware's bug of also going by the wrong bytes of oam.
+static void evaluate_sprites(Famicom_ppu* ppu)
+{
+	memset(ppu->sprite_line, 0, sizeof(ppu->sprite_line));
+	ppu->sprites_found = 0;
+	ppu->sprite_zero_found = false;
+	if (PPU_HEIGHT <= ppu->scanline)
+		return;
+	int height = ppu->ctrl & PPUCTRL_SPRITE_SIZE ? 16 : 8;
+	for (int i=0; i<64; i++) {
+		int row = ppu->scanline - ppu->oam[i][0];
+		if (row < 0 || height <= row)
+			continue;
+		if (ppu->sprites_found == PPU_SPRITES_PER_LINE) {
+			ppu->status |= PPUSTATUS_OVERFLOW;
+			break;
+		}
+		memcpy(ppu->secondary_oam[ppu->sprites_found], ppu->oam[i], 4);
+		if (i == 0)
+			ppu->sprite_zero_found = true;
+		ppu->sprites_found++;
+	}
+	// the lowest numbered sprite is in front, so it goes in last
+	for (int i=ppu->sprites_found-1; i>=0; i--)
+		decode_sprite(ppu, i, height);
+}
+
+// draws the whole of the current line into screen as it starts, merging the
+// sprites and background by their priority
+static void render_line(Famicom_ppu* ppu)
+{
+	word* out = ppu->screen[ppu->scanline];
+	byte grey = ppu->mask & PPUMASK_GREYSCALE ? 0x30 : 0x3F;
+	word emphasis = (ppu->mask & PPUMASK_EMPHASIS) << 1;
+	ppu->sprite0_dot = -1;
+	if (!(ppu->mask & (PPUMASK_BG | PPUMASK_SPRITES))) {
+		// the backdrop, unless v points into the palettes
+		byte entry = (ppu->v & 0x3F00) == 0x3F00 ? palette_index(ppu->v) : 0;
+		word colour = emphasis | (ppu->palettes[entry] & grey);
+		for (int x=0; x<PPU_WIDTH; x++)
+			out[x] = colour;
+		return;
+	}
+	byte background[PPU_WIDTH];
+	render_background(ppu, background);
+	bool sprites = ppu->mask & PPUMASK_SPRITES;
+	for (int x=0; x<PPU_WIDTH; x++) {
+		byte bg = background[x];
+		byte sprite = sprites && (8 <= x || ppu->mask & PPUMASK_SPRITES_LEFT) ? ppu->sprite_line[x] : 0;
+		byte entry = bg;
+		if (sprite) {
+			if (bg && sprite & PPU_SPRITE_ZERO && x != 255 && ppu->sprite0_dot < 0)
+				ppu->sprite0_dot = x + 1;
+			if (!bg || !(sprite & PPU_SPRITE_BEHIND))
+				entry = sprite & 0x1F;
+		}
+		out[x] = emphasis | (ppu->palettes[entry] & grey);
+	}
+}
+
+// the dots until the ppu next changes something the cpu can see without
+// touching it: vblank starting or ending, a sprite 0 hit, or the frame ending.
+// a sprite 0 hit is only known once its line starts, so until then this is the
+// start of each line sprite 0 could be on. it can be early, but never late.
+int ppu_next_event(Famicom_ppu* ppu)
+{
+	int here = ppu->scanline * PPU_DOTS + ppu->dot; // the dot the next tick does
+	int next = PPU_SCANLINES * PPU_DOTS - 1; // the last dot's tick starts the next frame
+	bool rendering = ppu->mask & (PPUMASK_BG | PPUMASK_SPRITES);
+	// odd frames skip a dot while rendering
+	if (rendering && ppu->odd_frame && here <= PPU_PRERENDER_LINE * PPU_DOTS + 339)
+		next--;
+	int events[2] = { PPU_VBLANK_LINE * PPU_DOTS + 1, PPU_PRERENDER_LINE * PPU_DOTS + 1 };
+	for (int i=0; i<2; i++) {
+		if (here <= events[i] && events[i] < next)
+			next = events[i];
+	}
+	if (rendering && !(ppu->status & PPUSTATUS_SPRITE0) && ppu->scanline < PPU_HEIGHT) {
+		if (0 <= ppu->sprite0_dot && 1 < ppu->dot && ppu->dot <= ppu->sprite0_dot) {
+			next = ppu->scanline * PPU_DOTS + ppu->sprite0_dot;
+		} else {
+			// sprites are drawn on the lines after their y
+			int first = ppu->oam[0][0] + 1;
+			int last = ppu->oam[0][0] + (ppu->ctrl & PPUCTRL_SPRITE_SIZE ? 16 : 8);
+			int line = ppu->dot <= 1 ? ppu->scanline : ppu->scanline + 1;
+			if (line < first)
+				line = first;
+			if (line <= last && line < PPU_HEIGHT && line * PPU_DOTS + 1 < next)
+				next = line * PPU_DOTS + 1;
+		}
+	}
+	return next - here + 1;
+}
+
+// one dot of ntsc timing: the scroll updates rendering does to v, sprites,
+// vblank, and a line drawn at a time as it starts
+void ppu_tick(Famicom_ppu* ppu)
+{
+	bool rendering = ppu->mask & (PPUMASK_BG | PPUMASK_SPRITES);
+	int dot = ppu->dot;
+	if (ppu->scanline < PPU_HEIGHT) {
+		if (dot == 1)
+			render_line(ppu);
+		if (dot == ppu->sprite0_dot)
+			ppu->status |= PPUSTATUS_SPRITE0;
+	}
+	if (rendering && (ppu->scanline < PPU_HEIGHT || ppu->scanline == PPU_PRERENDER_LINE)) {
+		if (dot != 0 && (dot <= 256 || 328 <= dot) && (dot & 0x07) == 0)
+			increment_coarse_x(ppu);
+		if (dot == 256)
+			increment_y(ppu);
+		if (dot == 257) {
+			ppu->v = (ppu->v & ~0x041F) | (ppu->t & 0x041F);
+			ppu->oam_address = 0;
+			evaluate_sprites(ppu);
+		}
+		if (ppu->scanline == PPU_PRERENDER_LINE && 280 <= dot && dot <= 304)
+			ppu->v = (ppu->v & ~0x7BE0) | (ppu->t & 0x7BE0);
+		// the next line's first two tiles are fetched from here on
+		if (dot == 320)
+			ppu->line_v = ppu->v;
+	}
+	if (dot == 1) {
+		if (ppu->scanline == PPU_VBLANK_LINE)
+			ppu->status |= PPUSTATUS_VBLANK;
+		else if (ppu->scanline == PPU_PRERENDER_LINE)
+			ppu->status = 0;
+	}
+	// odd frames are a dot shorter while rendering
+	if (ppu->scanline == PPU_PRERENDER_LINE && dot == 339 && ppu->odd_frame && rendering)
+		dot++;
+	ppu->dot = dot + 1;
+	if (ppu->dot == PPU_DOTS) {
+		ppu->dot = 0;
+		ppu->scanline++;
+		if (ppu->scanline == PPU_SCANLINES) {
+			ppu->scanline = 0;
+			ppu->odd_frame = !ppu->odd_frame;
+			ppu->frame++;
+		}
+	}
+}
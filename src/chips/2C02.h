@@ -1,20 +1,113 @@
+// the famicom's picture processing unit. the cpu sees it through eight
+// registers, behind which is the ppu's own 14 bit bus: the cartridge's chr at
+// $0000-$1FFF, the nametables at $2000-$3EFF and the palettes at $3F00-$3FFF.
+// chr and nametables are reached through 1 KB page pointers, so a mapper or
+// the mirroring only has to point them somewhere else.
+
+#define PPUCTRL_NAMETABLE 0x03
+#define PPUCTRL_INCREMENT 0x04 // 32 instead of 1
+#define PPUCTRL_SPRITE_TABLE 0x08
+#define PPUCTRL_BG_TABLE 0x10
+#define PPUCTRL_SPRITE_SIZE 0x20
+#define PPUCTRL_NMI 0x80
+
+#define PPUMASK_GREYSCALE 0x01
+#define PPUMASK_BG_LEFT 0x02
+#define PPUMASK_SPRITES_LEFT 0x04
+#define PPUMASK_BG 0x08
+#define PPUMASK_SPRITES 0x10
+#define PPUMASK_EMPHASIS 0xE0 // red, green and blue on ntsc, green and red swapped on pal
+
+#define PPUSTATUS_OVERFLOW 0x20
+#define PPUSTATUS_SPRITE0 0x40
+#define PPUSTATUS_VBLANK 0x80
+
+#define PPU_DOTS 341
+#define PPU_SCANLINES 262
+#define PPU_VBLANK_LINE 241
+#define PPU_PRERENDER_LINE 261
+#define PPU_WIDTH 256
+#define PPU_HEIGHT 240
+#define PPU_SPRITES_PER_LINE 8
+#define PPU_LINE_TILES 33
+#define PPU_CACHE_ROWS 30 // rows of tiles in a nametable, the attributes come after
+
+// an entry in the sprite line buffer is the sprite's palette address, 0 where
+// no sprite is, with these on top
+#define PPU_SPRITE_BEHIND 0x20 // drawn behind the background
+#define PPU_SPRITE_ZERO 0x40 // from oam entry 0, for sprite 0 hits
+
+enum ppu_register {
+	PPUCTRL,
+	PPUMASK,
+	PPUSTATUS,
+	OAMADDR,
+	OAMDATA,
+	PPUSCROLL,
+	PPUADDR,
+	PPUDATA,
+};
+
+// in the order of the ines header's mirroring bit
+enum ppu_mirroring {
+	mirroring_horizontal,
+	mirroring_vertical,
+	mirroring_single_a,
+	mirroring_single_b,
+	mirroring_four_screen,
+};
+
 typedef struct ppu {
-	bool vblank_flag;
-	bool nmi_enable;
-	bool write_latch;
-	byte vram_addr;
-	word address;
-	byte nametable_base;
-	bool vram_increment;
-	bool bg_pattern_table;
-	bool sprite_pattern_table;
-	byte nametable[4][960];
-	byte attribute_table[4][64];
-	byte oam[64][4];
+	byte ctrl;
+	byte mask;
+	byte status; // only the top three bits
 	byte oam_address;
-	byte palettes[0x20];
-	byte scroll_x;
-	byte scroll_y;
+	// loopy's internal registers. v is the vram address, and the scroll while
+	// rendering, t is what v is reloaded from, x the fine x scroll and w which
+	// of the two writes to PPUSCROLL or PPUADDR comes next.
+	word v;
+	word t;
 	byte x;
-	byte y;
+	bool w;
+	word line_v; // v as the current line started
+	byte read_buffer; // PPUDATA reads return the previous read
+	byte latch; // the last value on the cpu side of the bus, read back from write-only registers
+	byte* pattern[8];
+	bool chr_writable;
+	byte* nametables[4];
+	byte nametable_pages[4]; // which 1 KB of ciram each of them is
+	byte ciram[0x1000]; // 2 KB in the famicom, the rest for four screen carts
+	byte palettes[0x20];
+	byte oam[64][4];
+	byte secondary_oam[PPU_SPRITES_PER_LINE][4]; // the sprites found for the next line
+	int sprites_found;
+	bool sprite_zero_found; // the first of them is oam entry 0
+	byte sprite_line[PPU_WIDTH]; // the next line's sprites, already decoded
+	int sprite0_dot; // when this line's sprite 0 hit happens, -1 for never
+	// the frame, each pixel a colour from palette ram with the emphasis bits
+	// above it, 9 bits in all
+	word screen[PPU_HEIGHT][PPU_WIDTH];
+	struct ppu_kernels* kernels; // what draws the lines, see 2C02_kernels.h
+	// with ppu_cache_background() the background of each 1 KB of ciram is
+	// kept drawn out in full, and lines are copied from it. only the tiles
+	// marked in cache_dirty, a bit each, are drawn again.
+	byte (*cache)[PPU_HEIGHT][PPU_WIDTH];
+	uint32_t cache_dirty[4][PPU_CACHE_ROWS];
+	byte cache_table; // the PPUCTRL_BG_TABLE it was drawn from
+	int dot;
+	int scanline;
+	bool odd_frame;
+	uint64_t frame;
 } Famicom_ppu;
+
+void ppu_reset(Famicom_ppu* ppu, bool warm);
+void ppu_set_mirroring(Famicom_ppu* ppu, enum ppu_mirroring mirroring);
+void ppu_set_chr(Famicom_ppu* ppu, byte* chr, bool writable);
+bool ppu_cache_background(Famicom_ppu* ppu, bool enable);
+byte ppu_read(Famicom_ppu* ppu, word addr);
+void ppu_write(Famicom_ppu* ppu, word addr, byte value);
+byte ppu_read_register(Famicom_ppu* ppu, byte reg);
+void ppu_write_register(Famicom_ppu* ppu, byte reg, byte value);
+bool ppu_nmi(Famicom_ppu* ppu);
+void ppu_tick(Famicom_ppu* ppu);
+int ppu_next_event(Famicom_ppu* ppu);
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <pthread.h>
+#include "../types.h"
+#include "../bitmath.h"
+#include "2C02_kernels.h"
+
+#define EXPAND_SPREAD 0x0101010101010101ULL // a byte times this is in all 8 bytes
+
+static bool supported_scalar()
+{
+	return true;
+}
+
+static void expand_scalar(byte* low, byte* high, byte* palette, int n, bool flip, byte* out)
+{
+	for (int i=0; i<n; i++) {
+		byte l = flip ? reverse_byte_order(low[i]) : low[i];
+		byte h = flip ? reverse_byte_order(high[i]) : high[i];
+		for (int bit=7; bit>=0; bit--) {
+			byte pixel = ((l >> bit) & 1) | ((h >> bit) & 1) << 1;
+			*out++ = pixel ? palette[i] | pixel : 0;
+		}
+	}
+}
+
+static void colours_scalar(word* screen, uint32_t* table, int n, uint32_t* out)
+{
+	for (int i=0; i<n; i++)
+		out[i] = table[screen[i]];
+}
+
+Ppu_kernels ppu_kernels_scalar = { "scalar", supported_scalar, expand_scalar, colours_scalar };
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// each tile's bitplanes are spread over 8 bytes and tested against one bit per
+// byte, leftmost pixel first
+static bool supported_sse2()
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("sse2")))
+static void expand_sse2(byte* low, byte* high, byte* palette, int n, bool flip, byte* out)
+{
+	__m128i bits = flip
+	    ? _mm_set_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1)
+	    : _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+	__m128i one = _mm_set1_epi8(1);
+	__m128i two = _mm_set1_epi8(2);
+	int i;
+	for (i=0; i+2<=n; i+=2) {
+		__m128i l = _mm_set_epi64x(low[i+1] * EXPAND_SPREAD, low[i] * EXPAND_SPREAD);
+		__m128i h = _mm_set_epi64x(high[i+1] * EXPAND_SPREAD, high[i] * EXPAND_SPREAD);
+		__m128i p = _mm_set_epi64x(palette[i+1] * EXPAND_SPREAD, palette[i] * EXPAND_SPREAD);
+		__m128i pixels = _mm_or_si128(
+		    _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(l, bits), bits), one),
+		    _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(h, bits), bits), two));
+		__m128i transparent = _mm_cmpeq_epi8(pixels, _mm_setzero_si128());
+		_mm_storeu_si128((__m128i*)(out + i*8), _mm_andnot_si128(transparent, _mm_or_si128(pixels, p)));
+	}
+	expand_scalar(low + i, high + i, palette + i, n - i, flip, out + i*8);
+}
+
+static bool supported_avx2()
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static void expand_avx2(byte* low, byte* high, byte* palette, int n, bool flip, byte* out)
+{
+	__m256i bits = flip
+	    ? _mm256_set1_epi64x(0x8040201008040201ULL)
+	    : _mm256_set1_epi64x(0x0102040810204080ULL);
+	__m256i one = _mm256_set1_epi8(1);
+	__m256i two = _mm256_set1_epi8(2);
+	int i;
+	for (i=0; i+4<=n; i+=4) {
+		__m256i l = _mm256_set_epi64x(low[i+3] * EXPAND_SPREAD, low[i+2] * EXPAND_SPREAD, low[i+1] * EXPAND_SPREAD, low[i] * EXPAND_SPREAD);
+		__m256i h = _mm256_set_epi64x(high[i+3] * EXPAND_SPREAD, high[i+2] * EXPAND_SPREAD, high[i+1] * EXPAND_SPREAD, high[i] * EXPAND_SPREAD);
+		__m256i p = _mm256_set_epi64x(palette[i+3] * EXPAND_SPREAD, palette[i+2] * EXPAND_SPREAD, palette[i+1] * EXPAND_SPREAD, palette[i] * EXPAND_SPREAD);
+		__m256i pixels = _mm256_or_si256(
+		    _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(l, bits), bits), one),
+		    _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(h, bits), bits), two));
+		__m256i transparent = _mm256_cmpeq_epi8(pixels, _mm256_setzero_si256());
+		_mm256_storeu_si256((__m256i*)(out + i*8), _mm256_andnot_si256(transparent, _mm256_or_si256(pixels, p)));
+	}
+	expand_sse2(low + i, high + i, palette + i, n - i, flip, out + i*8);
+}
+
+// sse2 has no gather, so the sse2 set keeps the scalar lookup
+__attribute__((target("avx2")))
+static void colours_avx2(word* screen, uint32_t* table, int n, uint32_t* out)
+{
+	int i;
+	for (i=0; i+8<=n; i+=8) {
+		__m256i index = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i*)(screen + i)));
+		_mm256_storeu_si256((__m256i*)(out + i), _mm256_i32gather_epi32((int*)table, index, 4));
+	}
+	colours_scalar(screen + i, table, n - i, out + i);
+}
+
+Ppu_kernels ppu_kernels_sse2 = { "sse2", supported_sse2, expand_sse2, colours_scalar };
+Ppu_kernels ppu_kernels_avx2 = { "avx2", supported_avx2, expand_avx2, colours_avx2 };
+
+Ppu_kernels* ppu_kernels_all[] = { &ppu_kernels_scalar, &ppu_kernels_sse2, &ppu_kernels_avx2, NULL };
+#else
+Ppu_kernels* ppu_kernels_all[] = { &ppu_kernels_scalar, NULL };
+#endif
+
+static Ppu_kernels* best = NULL;
+static pthread_once_t best_found = PTHREAD_ONCE_INIT;
+
+static void find_best()
+{
+	for (int i=0; ppu_kernels_all[i] != NULL; i++) {
+		if (ppu_kernels_all[i]->supported())
+			best = ppu_kernels_all[i];
+	}
+}
+
+Ppu_kernels* ppu_kernels_best()
+{
+	pthread_once(&best_found, find_best);
+	return best;
+}
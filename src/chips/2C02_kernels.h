@@ -0,0 +1,19 @@
+// the inner loops of drawing a line, with a version for each instruction set
+// the host might have. the scalar ones work everywhere, ppu_kernels_best()
+// picks the fastest the cpu we're running on supports.
+
+typedef struct ppu_kernels {
+	char* name;
+	bool (*supported)();
+	// turns n tile rows, given as their two bitplanes, into 8n pixels left to
+	// right, each palette[tile] | the 2 bit pixel, or 0 where it's transparent.
+	// flip reverses each tile, for sprites.
+	void (*expand)(byte* low, byte* high, byte* palette, int n, bool flip, byte* out);
+	// looks the ppu's 9 bit colours up in a 512 entry table
+	void (*colours)(word* screen, uint32_t* table, int n, uint32_t* out);
+} Ppu_kernels;
+
+extern Ppu_kernels ppu_kernels_scalar;
+extern Ppu_kernels* ppu_kernels_all[]; // NULL terminated, slowest first
+
+Ppu_kernels* ppu_kernels_best();
@@ -43,6 +43,24 @@ enum operation {
 	instruction_plp,
 	set_flag,
 	clear_flag,
+	// undocumented
+	shift_left_or_a,
+	rotate_left_and_a,
+	shift_right_xor_a,
+	rotate_right_add,
+	decrement_compare,
+	increment_subtract,
+	write_mem_a_and_x,
+	write_mem_and_high,
+	alter_register_a_x,
+	alter_register_a_x_sp,
+	alter_register_a_x_magic,
+	and_a_carry,
+	and_a_shift_right,
+	and_a_rotate_right,
+	and_a_x_magic,
+	and_x_subtract,
+	halt,
 };
 
 enum flag {
@@ -57,9 +75,9 @@ enum flag {
 };
 
 enum addressing_mode {
+	implied,
 	relative,
 	immediate,
-	implied,
 	accumulator,
 	absolute,
 	zeropage,
@@ -72,7 +90,9 @@ enum addressing_mode {
 	zeropage_yi,
 };
 
+// unimplemented and implied are zero so opcodes missing from the table decode as them
 enum instruction_name {
+	unimplemented,
 	LDA, LDX, LDY, STA, STX, STY,
 	ADC, SBC, INC, INX, INY, DEC,
 	DEX, DEY, ASL, LSR, ROL, ROR,
@@ -83,29 +103,80 @@ enum instruction_name {
 	PLP, JMP, JSR, RTS, RTI, CLC,
 	SEC, CLD, SED, CLI, SEI, CLV,
 	BRK, NOP,
-	unimplemented
+	// undocumented
+	SLO, RLA, SRE, RRA, SAX, LAX,
+	DCP, ISC, ANC, ALR, ARR, ANE,
+	LXA, SBX, SHA, SHX, SHY, TAS,
+	LAS, JAM,
 };
 
-typedef struct parsed_instruction {
-	enum addressing_mode a;
-	enum instruction_name n;
-	char* m;
-	byte o;
-} Instruction;
+typedef struct opcode {
+	byte n; // enum instruction_name
+	byte a; // enum addressing_mode
+} Opcode;
+
+// an instruction as fetched from memory, small enough to be cached per address
+typedef struct decoded_instruction {
+	byte n; // enum instruction_name
+	byte a; // enum addressing_mode
+	byte oper[2];
+	byte length;
+	byte fetch_cycles;
+} Decoded_instruction;
+
+typedef struct operation_entry {
+	enum operation o;
+	enum register_ r;
+	enum flag f;
+} Operation;
+
+enum interrupt {
+	interrupt_none,
+	interrupt_irq,
+	interrupt_nmi,
+};
 
 typedef struct cpu_6502 {
 	word pc;
 	byte reg[5];
+	// N, Z, C and V are kept as the values they were computed from and only
+	// packed into reg[reg_p] by cpu_get_p(), which is what PHP, BRK, interrupts
+	// and tracing see. reg[reg_p] itself only holds I, D and the unused bit.
+	byte flag_n; // N is bit 7
+	byte flag_z; // Z is set when this is zero
+	byte flag_c; // 0 or 1
+	byte flag_v; // V is bit 7
 	bool running;
 	bool branch_taken;
-	char* current_instruction_name;
-	Instruction current_instruction;
-	byte oper[2];
+	uint64_t cycles; // one per bus access
+	// irq is level triggered, every source holding it low has a bit in
+	// irq_lines. nmi is edge triggered, its rising edge sets nmi_pending until
+	// the nmi is taken. both keep the cycle they arrived on, as the cpu only
+	// sees them at polls after it.
+	byte irq_lines;
+	bool nmi_line;
+	bool nmi_pending;
+	uint64_t irq_cycle;
+	uint64_t nmi_cycle;
+	// enum interrupt, what the poll at the end of the last instruction found.
+	// it's taken instead of the next instruction.
+	byte interrupt;
 } Cpu_6502;
 
+extern const Opcode opcodes[256];
+extern const Operation operations[];
+extern const char* const mnemonics[];
+
 void write_cpu_state (Cpu_6502* cpu, System system, FILE* f);
-Instruction parse(byte opcode);
+byte cpu_get_p(Cpu_6502* cpu);
+void cpu_set_p(Cpu_6502* cpu, byte p);
+void cpu_set_irq(Cpu_6502* cpu, byte source, bool asserted);
+void cpu_set_irq_at(Cpu_6502* cpu, byte source, uint64_t cycle);
+void cpu_set_nmi(Cpu_6502* cpu, bool asserted);
+bool cpu_interrupt_possible(Cpu_6502* cpu);
 
 void cpu_reset(Cpu_6502* cpu, System system);
-void step(System system, Cpu_6502* cpu, struct parsed_instruction i, byte oper[2]);
-void nmi(System system, Cpu_6502* cpu);
+void step(System system, Cpu_6502* cpu);
+void decode(System system, Cpu_6502* cpu, Decoded_instruction* d);
+void execute(System system, Cpu_6502* cpu, Decoded_instruction* d);
+void interrupt(System system, Cpu_6502* cpu);
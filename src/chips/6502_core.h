@@ -0,0 +1,725 @@
+// the part of the 6502 that touches the bus. it's included by each system with
+// CORE_MACHINE, CORE_BUS and CORE_PREFIX defined, so every system gets its own
+// copy of the core calling its memory map directly:
+//
+//	#define CORE_MACHINE Famicom
+//	#define CORE_BUS mmap_famicom
+//	#define CORE_PREFIX famicom_cpu_
+//	#include "../chips/6502_core.h"
+//
+// which defines famicom_cpu_reset(), _interrupt(), _decode(), _execute() and _step().
+// CORE_DECIMAL also gives the core the nmos decimal mode, the famicom's 2A03
+// doesn't have it.
+
+#define CORE_CAT_(a, b) a##b
+#define CORE_CAT(a, b) CORE_CAT_(a, b)
+#define CORE(name) CORE_CAT(CORE_PREFIX, name)
+
+#define MEM_READ(ad) 			(cpu->cycles++, CORE_BUS(machine, ad, 0, false))
+#define MEM_WRITE(ad, v) 	(cpu->cycles++, CORE_BUS(machine, ad, v, true))
+#define DEBUG_READ(ad) 		CORE_BUS(machine, ad, 0, false)
+#define PUSH_STACK(v) 		MEM_WRITE(0x100 + cpu->reg[reg_sp], v); cpu->reg[reg_sp] -= 1;
+#define PULL_STACK( )			({cpu->reg[reg_sp] += 1; MEM_READ(0x100 + cpu->reg[reg_sp]);})
+
+static bool get_p ( Cpu_6502* cpu, enum flag f )
+{
+	switch (f) {
+	case carry:
+		return cpu->flag_c;
+	case zero:
+		return cpu->flag_z == 0;
+	case overflow:
+		return cpu->flag_v & 0x80;
+	case negative:
+		return cpu->flag_n & 0x80;
+	default:
+		return (cpu->reg[reg_p] >> f) & 1;
+	}
+}
+
+static void set_p ( Cpu_6502* cpu, enum flag f, bool value )
+{
+	switch (f) {
+	case carry:
+		cpu->flag_c = value;
+		break;
+	case zero:
+		cpu->flag_z = !value;
+		break;
+	case overflow:
+		cpu->flag_v = value << 7;
+		break;
+	case negative:
+		cpu->flag_n = value << 7;
+		break;
+	default:
+		if (value) {
+			cpu->reg[reg_p] |= 1 << f;
+		} else {
+			cpu->reg[reg_p] &= ~(1 << f);
+		}
+		break;
+	}
+}
+
+// the decimal results are the nmos 6502's, including its n, v and z flags,
+// which come from the binary sum or partially adjusted digits
+static void add_with_carry(Cpu_6502* cpu, byte operand)
+{
+	byte a = cpu->reg[reg_a];
+	int sum = a + operand + cpu->flag_c;
+	byte value = (byte)sum;
+	cpu->flag_z = value;
+#ifdef CORE_DECIMAL
+	if (get_p(cpu, decimal)) {
+		int low = (a & 0x0F) + (operand & 0x0F) + cpu->flag_c;
+		if (9 < low)
+			low += 6;
+		int high = (a >> 4) + (operand >> 4) + (0x0F < low);
+		cpu->flag_n = high << 4;
+		cpu->flag_v = ~(a ^ operand) & (a ^ (high << 4));
+		if (9 < high)
+			high += 6;
+		cpu->flag_c = 0x0F < high;
+		cpu->reg[reg_a] = high << 4 | (low & 0x0F);
+		return;
+	}
+#endif
+	cpu->reg[reg_a] = value;
+	cpu->flag_n = value;
+	cpu->flag_c = sum >> 8;
+	cpu->flag_v = (value ^ a) & (value ^ operand);
+}
+
+static void subtract_with_carry(Cpu_6502* cpu, byte operand)
+{
+	// a - m - !c is the same as a + ~m + c, and the flags are always binary
+	byte a = cpu->reg[reg_a];
+	int sum = a + (byte)~operand + cpu->flag_c;
+	byte value = (byte)sum;
+	cpu->flag_n = value;
+	cpu->flag_z = value;
+	cpu->flag_v = (value ^ a) & (value ^ (byte)~operand);
+#ifdef CORE_DECIMAL
+	if (get_p(cpu, decimal)) {
+		int low = (a & 0x0F) - (operand & 0x0F) - !cpu->flag_c;
+		int high = (a >> 4) - (operand >> 4);
+		if (low & 0x10) {
+			low -= 6;
+			high--;
+		}
+		if (high & 0x10)
+			high -= 6;
+		value = high << 4 | (low & 0x0F);
+	}
+#endif
+	cpu->flag_c = sum >> 8;
+	cpu->reg[reg_a] = value;
+}
+
+void CORE(reset)(CORE_MACHINE* machine, Cpu_6502* cpu)
+{
+	byte low;
+	memset(cpu->reg, 0, sizeof(cpu->reg));
+	cpu_set_p(cpu, 0x20); // 00100000 (the unused flag needs to be set)
+	cpu->reg[reg_sp] = 0xFD;
+	cpu->cycles = 0;
+	low = MEM_READ(0xFFFC);
+	cpu->pc = bytes_to_word(MEM_READ(0xFFFD), low);
+	cpu->running = true;
+	cpu->irq_lines = 0;
+	cpu->nmi_line = false;
+	cpu->nmi_pending = false;
+	cpu->interrupt = interrupt_none;
+}
+
+// pushes pc and p and jumps through the vector, for brk, irq and nmi alike. an
+// nmi that comes in before p is pushed takes over the sequence and its vector,
+// even from a brk, which still pushes p with B set.
+static void interrupt_sequence(CORE_MACHINE* machine, Cpu_6502* cpu, word pc, byte b, word vector)
+{
+	byte low;
+	PUSH_STACK(get_higher_byte(pc));
+	PUSH_STACK(get_lower_byte(pc));
+	PUSH_STACK(cpu_get_p(cpu) | 0x20 | b);
+	if (cpu->nmi_pending && cpu->nmi_cycle < cpu->cycles) {
+		cpu->nmi_pending = false;
+		vector = 0xFFFA;
+	}
+	set_p(cpu, interrupt_disable, true);
+	low = MEM_READ(vector);
+	cpu->pc = bytes_to_word(MEM_READ(vector + 1), low);
+}
+
+// interrupts are polled at the end of the second to last cycle of an
+// instruction, so they have to have arrived a cycle before the instruction ends.
+// a taken branch that stays on its page polls a cycle before that, and CLI, SEI
+// and PLP poll with the I flag from before they changed it.
+static void poll(Cpu_6502* cpu, byte n, word pc, byte p)
+{
+	uint64_t at = cpu->cycles - 1;
+	switch (n) {
+	case BRK:
+		// the handler's first instruction always runs
+		return;
+	case CLI: case SEI: case PLP:
+		break;
+	case BCC: case BCS: case BNE: case BEQ:
+	case BPL: case BMI: case BVC: case BVS:
+		if (cpu->branch_taken && ((pc + 2) & 0xFF00) == (cpu->pc & 0xFF00))
+			at--;
+		// fallthrough
+	default:
+		p = cpu->reg[reg_p];
+		break;
+	}
+	if (cpu->nmi_pending && cpu->nmi_cycle <= at)
+		cpu->interrupt = interrupt_nmi;
+	else if (cpu->irq_lines && cpu->irq_cycle <= at && !(p & 1 << interrupt_disable))
+		cpu->interrupt = interrupt_irq;
+}
+
+// computes the effective address of an operand, doing the same reads as the
+// 6502 does on the way there. write is true for stores and read-modify-write
+// instructions, which always do the dummy read of the unfixed address when
+// indexing, reads only do it when the index crosses a page.
+static word address (CORE_MACHINE* machine, Cpu_6502* cpu, byte oper[2], enum addressing_mode a, bool write)
+{
+	word addr_a = bytes_to_word(oper[1], oper[0]);
+	word addr_f;
+	byte low;
+	byte index;
+	switch (a) {
+	case zeropage:
+		return oper[0];
+	case absolute:
+		return addr_a;
+	case zeropage_x:
+		MEM_READ(oper[0]);
+		return (byte)(oper[0] + cpu->reg[reg_x]);
+	case zeropage_y:
+		MEM_READ(oper[0]);
+		return (byte)(oper[0] + cpu->reg[reg_y]);
+	case absolute_x:
+	case absolute_y:
+		index = a == absolute_x ? cpu->reg[reg_x] : cpu->reg[reg_y];
+		addr_f = addr_a + index;
+		if (write || (addr_f & 0xFF00) != (addr_a & 0xFF00))
+			MEM_READ((addr_a & 0xFF00) | (addr_f & 0xFF));
+		return addr_f;
+	case zeropage_xi:
+		MEM_READ(oper[0]);
+		low = MEM_READ((byte)(oper[0] + cpu->reg[reg_x]));
+		return bytes_to_word(MEM_READ((byte)(oper[0] + cpu->reg[reg_x] + 1)), low);
+	case zeropage_yi:
+		low = MEM_READ(oper[0]);
+		addr_a = bytes_to_word(MEM_READ((byte)(oper[0] + 1)), low);
+		addr_f = addr_a + cpu->reg[reg_y];
+		if (write || (addr_f & 0xFF00) != (addr_a & 0xFF00))
+			MEM_READ((addr_a & 0xFF00) | (addr_f & 0xFF));
+		return addr_f;
+	default:
+		return 0;
+	}
+}
+
+static byte peek(CORE_MACHINE* machine, Cpu_6502* cpu, enum addressing_mode a, byte oper[2] )
+{
+	switch (a) {
+	case immediate:
+		return oper[0];
+	case accumulator:
+		return cpu->reg[reg_a];
+	default:
+		return MEM_READ(address(machine, cpu, oper, a, false));
+	}
+}
+
+static void instruction (CORE_MACHINE* machine, Cpu_6502* cpu, const Decoded_instruction* d)
+{
+	// copied out as d can be overwritten by the instruction's own writes
+	const Operation* op = &operations[d->n];
+	enum operation o = op->o;
+	enum register_ r = op->r;
+	enum flag f = op->f;
+	enum addressing_mode a = d->a;
+	byte oper[2] = { d->oper[0], d->oper[1] };
+	byte value;
+	byte value_old;
+	byte operand;
+	word addr;
+	word opera = bytes_to_word(oper[1], oper[0]);
+	byte low;
+	byte high;
+	cpu->branch_taken = false;
+
+	switch (o) {
+	case no_op:
+		// the undocumented ones with an operand still read it
+		if (a != implied)
+			peek(machine, cpu, a, oper);
+		break;
+	//memory
+	case write_mem:
+		MEM_WRITE(address(machine, cpu, oper, a, true), cpu->reg[r]);
+		break;
+
+	case increment_mem:
+	case decrement_mem:
+	case shift_rol:
+	case shift_ror:
+	case logical_shift_right:
+	case arithmetic_shift_left:
+	case shift_left_or_a:
+	case rotate_left_and_a:
+	case shift_right_xor_a:
+	case rotate_right_add:
+	case decrement_compare:
+	case increment_subtract:
+		// read-modify-write: the unmodified value is written back before the result
+		if (a == accumulator) {
+			value_old = cpu->reg[reg_a];
+		} else {
+			addr = address(machine, cpu, oper, a, true);
+			value_old = MEM_READ(addr);
+			MEM_WRITE(addr, value_old);
+		}
+		switch (o) {
+		case increment_mem:
+		case increment_subtract:
+			value = value_old + 1;
+			break;
+		case decrement_mem:
+		case decrement_compare:
+			value = value_old - 1;
+			break;
+		case shift_rol:
+		case rotate_left_and_a:
+			value = value_old << 1 | cpu->flag_c;
+			cpu->flag_c = value_old >> 7;
+			break;
+		case shift_ror:
+		case rotate_right_add:
+			value = value_old >> 1 | cpu->flag_c << 7;
+			cpu->flag_c = value_old & 0x01;
+			break;
+		case logical_shift_right:
+		case shift_right_xor_a:
+			value = value_old >> 1;
+			cpu->flag_c = value_old & 0x01;
+			break;
+		default:
+			value = value_old << 1;
+			cpu->flag_c = value_old >> 7;
+			break;
+		}
+		if (a == accumulator) {
+			cpu->reg[reg_a] = value;
+		} else {
+			MEM_WRITE(addr, value);
+		}
+		// the undocumented ones then use the result like the instruction after it
+		switch (o) {
+		case shift_left_or_a:
+			value |= cpu->reg[reg_a];
+			cpu->reg[reg_a] = value;
+			break;
+		case rotate_left_and_a:
+			value &= cpu->reg[reg_a];
+			cpu->reg[reg_a] = value;
+			break;
+		case shift_right_xor_a:
+			value ^= cpu->reg[reg_a];
+			cpu->reg[reg_a] = value;
+			break;
+		case rotate_right_add:
+			add_with_carry(cpu, value);
+			return;
+		case increment_subtract:
+			subtract_with_carry(cpu, value);
+			return;
+		case decrement_compare:
+			value_old = value;
+			goto compare;
+		default:
+			break;
+		}
+		goto check_flag_nz;
+		break;
+
+	case compare_reg_mem:
+		value_old = peek(machine, cpu, a, oper);
+	compare:
+		value = cpu->reg[r] - value_old;
+		cpu->flag_c = value_old <= cpu->reg[r];
+		goto check_flag_nz;
+		break;
+
+	case compare_bit:
+		value = peek(machine, cpu, a, oper);
+		cpu->flag_z = value & cpu->reg[reg_a];
+		cpu->flag_n = value;
+		cpu->flag_v = value << 1;
+		break;
+
+		//register
+	case alter_register:
+		value = peek(machine, cpu, a, oper);
+		cpu->reg[r] = value;
+		goto check_flag_nz;
+		break;
+
+	case add:
+		add_with_carry(cpu, peek(machine, cpu, a, oper));
+		break;
+
+	case subtract:
+		subtract_with_carry(cpu, peek(machine, cpu, a, oper));
+		break;
+
+	case increment_reg:
+		cpu->reg[r] += 1;
+		value = cpu->reg[r];
+		goto check_flag_nz;
+		break;
+
+	case decrement_reg:
+		cpu->reg[r] -= 1;
+		value = cpu->reg[r];
+		goto check_flag_nz;
+		break;
+
+	case and_a:
+		value = peek(machine, cpu, a, oper) & cpu->reg[reg_a];
+		cpu->reg[reg_a] = value;
+		goto check_flag_nz;
+		break;
+
+	case or_a:
+		value = peek(machine, cpu, a, oper) | cpu->reg[reg_a];
+		cpu->reg[reg_a] = value;
+		goto check_flag_nz;
+		break;
+
+	case xor_a:
+		value = peek(machine, cpu, a, oper) ^ cpu->reg[reg_a];
+		cpu->reg[reg_a] = value;
+		goto check_flag_nz;
+		break;
+
+	case transfer_reg_a:
+		value = cpu->reg[r];
+		cpu->reg[reg_a] = value;
+		goto check_flag_nz;
+		break;
+	case transfer_reg_x:
+		value = cpu->reg[r];
+		cpu->reg[reg_x] = value;
+		goto check_flag_nz;
+		break;
+	case transfer_reg_sp:
+		value = cpu->reg[r];
+		cpu->reg[reg_sp] = value;
+		break;
+	case transfer_reg_y:
+		value = cpu->reg[r];
+		cpu->reg[reg_y] = value;
+		goto check_flag_nz;
+		break;
+
+		//branch
+        case branch:
+		if (a == absolute_indirect) {
+			// the pointer's high byte doesn't carry into the next page
+			low = MEM_READ(opera);
+			addr = bytes_to_word(MEM_READ((opera & 0xFF00) | ((opera + 1) & 0xFF)), low);
+		} else {
+			addr = opera;
+		}
+		cpu->pc = addr;
+		cpu->branch_taken = true;
+		break;
+
+	case branch_jsr:
+		addr = cpu->pc + 2;
+		MEM_READ(0x100 + cpu->reg[reg_sp]);
+		PUSH_STACK(get_higher_byte(addr));
+	        PUSH_STACK(get_lower_byte(addr));
+		// the high byte of the target is fetched after the pushes
+		cpu->pc = bytes_to_word(MEM_READ(addr), oper[0]);
+		cpu->branch_taken = true;
+		break;
+
+	case branch_rts:
+		MEM_READ(0x100 + cpu->reg[reg_sp]);
+		low = PULL_STACK();
+		high = PULL_STACK();
+		addr = bytes_to_word(high, low);
+		MEM_READ(addr);
+		cpu->pc = addr;
+		cpu->branch_taken = false;
+		break;
+
+	case branch_rti:
+		MEM_READ(0x100 + cpu->reg[reg_sp]);
+		cpu_set_p(cpu, (PULL_STACK() | 0x20) & ~0x10);
+		low = PULL_STACK();
+		high = PULL_STACK();
+		addr = bytes_to_word(high, low);
+		cpu->pc = addr;
+		cpu->branch_taken = true;
+		break;
+
+	case branch_brk:
+		interrupt_sequence(machine, cpu, cpu->pc + 2, 0x10, 0xFFFE);
+		cpu->branch_taken = true;
+		break;
+
+	case branch_conditional_flag:
+	case branch_conditional_flag_clear:
+		if (get_p(cpu, f) == (o == branch_conditional_flag)) {
+			// a taken branch reads the next opcode, and the wrong page if it crosses one
+			opera = cpu->pc + 2;
+			addr = (int8_t)oper[0] + opera;
+			MEM_READ(opera);
+			if ((addr & 0xFF00) != (opera & 0xFF00))
+				MEM_READ((opera & 0xFF00) | (addr & 0xFF));
+			cpu->pc = addr;
+			cpu->branch_taken = true;
+		}
+		break;
+
+	case push_reg_stack:
+		PUSH_STACK(cpu->reg[r]);
+		break;
+
+	case pull_reg_stack:
+		MEM_READ(0x100 + cpu->reg[reg_sp]);
+		value = PULL_STACK();
+		cpu->reg[r] = value;
+		break;
+
+	case instruction_php:
+		PUSH_STACK(cpu_get_p(cpu) | 0x30);
+		break;
+
+	case instruction_pla:
+		MEM_READ(0x100 + cpu->reg[reg_sp]);
+		value = PULL_STACK();
+		cpu->reg[reg_a] = value;
+		goto check_flag_nz;
+		break;
+
+	case instruction_plp:
+		MEM_READ(0x100 + cpu->reg[reg_sp]);
+		cpu_set_p(cpu, (PULL_STACK() | 0x20) & ~0x10);
+		break;
+
+	case set_flag:
+		set_p(cpu, f, true);
+		break;
+
+	case clear_flag:
+		set_p(cpu, f, false);
+		break;
+
+		//undocumented
+	case write_mem_a_and_x:
+		MEM_WRITE(address(machine, cpu, oper, a, true), cpu->reg[reg_a] & cpu->reg[reg_x]);
+		break;
+
+	case write_mem_and_high:
+		// stores the register anded with the high byte of the unindexed address
+		// plus one, which also replaces the high byte when indexing crosses a page
+		addr = address(machine, cpu, oper, a, true);
+		opera = addr - (a == absolute_x ? cpu->reg[reg_x] : cpu->reg[reg_y]);
+		if (r == reg_sp)
+			cpu->reg[reg_sp] = cpu->reg[reg_a] & cpu->reg[reg_x];
+		value = r == reg_y || r == reg_x ? cpu->reg[r] : cpu->reg[reg_a] & cpu->reg[reg_x];
+		value &= get_higher_byte(opera) + 1;
+		if ((addr & 0xFF00) != (opera & 0xFF00))
+			addr = bytes_to_word(value, get_lower_byte(addr));
+		MEM_WRITE(addr, value);
+		break;
+
+	case alter_register_a_x:
+		value = peek(machine, cpu, a, oper);
+		cpu->reg[reg_a] = value;
+		cpu->reg[reg_x] = value;
+		goto check_flag_nz;
+		break;
+
+	case alter_register_a_x_sp:
+		value = peek(machine, cpu, a, oper) & cpu->reg[reg_sp];
+		cpu->reg[reg_a] = value;
+		cpu->reg[reg_x] = value;
+		cpu->reg[reg_sp] = value;
+		goto check_flag_nz;
+		break;
+
+	case alter_register_a_x_magic:
+		// the 0xEE is what the chip's analog behaviour usually comes out as
+		value = (cpu->reg[reg_a] | 0xEE) & peek(machine, cpu, a, oper);
+		cpu->reg[reg_a] = value;
+		cpu->reg[reg_x] = value;
+		goto check_flag_nz;
+		break;
+
+	case and_a_x_magic:
+		value = (cpu->reg[reg_a] | 0xEE) & cpu->reg[reg_x] & peek(machine, cpu, a, oper);
+		cpu->reg[reg_a] = value;
+		goto check_flag_nz;
+		break;
+
+	case and_a_carry:
+		value = peek(machine, cpu, a, oper) & cpu->reg[reg_a];
+		cpu->reg[reg_a] = value;
+		cpu->flag_c = value >> 7;
+		goto check_flag_nz;
+		break;
+
+	case and_a_shift_right:
+		value_old = peek(machine, cpu, a, oper) & cpu->reg[reg_a];
+		value = value_old >> 1;
+		cpu->reg[reg_a] = value;
+		cpu->flag_c = value_old & 0x01;
+		goto check_flag_nz;
+		break;
+
+	case and_a_rotate_right:
+		value_old = peek(machine, cpu, a, oper) & cpu->reg[reg_a];
+		value = value_old >> 1 | cpu->flag_c << 7;
+#ifdef CORE_DECIMAL
+		if (get_p(cpu, decimal)) {
+			// n and z are from the rotated value, v from how bit 6 changed
+			cpu->flag_n = value;
+			cpu->flag_z = value;
+			cpu->flag_v = (value_old ^ value) << 1;
+			if (5 < (value_old & 0x0F) + (value_old & 0x01))
+				value = (value & 0xF0) | ((value + 6) & 0x0F);
+			cpu->flag_c = 0x50 < (value_old & 0xF0) + (value_old & 0x10);
+			if (cpu->flag_c)
+				value += 0x60;
+			cpu->reg[reg_a] = value;
+			break;
+		}
+#endif
+		cpu->reg[reg_a] = value;
+		cpu->flag_c = (value >> 6) & 0x01;
+		cpu->flag_v = (value << 1) ^ (value << 2);
+		goto check_flag_nz;
+		break;
+
+	case and_x_subtract:
+		value_old = peek(machine, cpu, a, oper);
+		operand = cpu->reg[reg_a] & cpu->reg[reg_x];
+		value = operand - value_old;
+		cpu->reg[reg_x] = value;
+		cpu->flag_c = value_old <= operand;
+		goto check_flag_nz;
+		break;
+
+	case halt:
+		// only a reset gets it going again
+		printf("cpu jammed at %04X\n", cpu->pc);
+		cpu->running = false;
+		cpu->branch_taken = true;
+		break;
+        }
+	return;
+check_flag_nz:
+	cpu->flag_n = value;
+	cpu->flag_z = value;
+	return;
+}
+
+// takes the interrupt the last poll found, in place of an instruction
+void CORE(interrupt)(CORE_MACHINE* machine, Cpu_6502* cpu)
+{
+	word vector = 0xFFFE;
+	if (cpu->interrupt == interrupt_nmi) {
+		cpu->nmi_pending = false;
+		vector = 0xFFFA;
+	}
+	cpu->interrupt = interrupt_none;
+	// the opcode fetch and operand read are done and discarded
+	MEM_READ(cpu->pc);
+	MEM_READ(cpu->pc);
+	interrupt_sequence(machine, cpu, cpu->pc, 0, vector);
+}
+
+// fetches the instruction at pc. the byte after the opcode is read by every
+// instruction, even when it has no operand, the one after that only by three
+// byte instructions. JSR reads its last byte itself after pushing pc.
+void CORE(decode)(CORE_MACHINE* machine, Cpu_6502* cpu, Decoded_instruction* d)
+{
+	Opcode i = opcodes[MEM_READ(cpu->pc)];
+	d->n = i.n;
+	d->a = i.a;
+	d->oper[0] = MEM_READ(cpu->pc + 1);
+	d->oper[1] = 0;
+	d->fetch_cycles = 2;
+	switch (i.a) {
+	case accumulator:
+	case implied:
+		d->length = 1;
+		break;
+	default:
+		d->length = 2;
+		break;
+	case absolute:
+	case absolute_indirect:
+	case absolute_x:
+	case absolute_y:
+		d->length = 3;
+		if (i.n != JSR) {
+			d->oper[1] = MEM_READ(cpu->pc + 2);
+			d->fetch_cycles = 3;
+		}
+		break;
+	}
+}
+
+// runs an instruction that has already been fetched
+void CORE(execute)(CORE_MACHINE* machine, Cpu_6502* cpu, Decoded_instruction* d)
+{
+	// the cached copy of d can be invalidated by the instruction writing over itself
+	byte length = d->length;
+	byte n = d->n;
+	word pc = cpu->pc;
+	byte p = cpu->reg[reg_p];
+	if (n == unimplemented) {
+		printf("unimplemented opcode %X!\n", DEBUG_READ(cpu->pc));
+		cpu->running = false;
+		return;
+	}
+	instruction(machine, cpu, d);
+	if (!cpu->branch_taken)
+		cpu->pc += length;
+	if (cpu->irq_lines | cpu->nmi_pending)
+		poll(cpu, n, pc, p);
+}
+
+// runs one instruction, including fetching it, or the interrupt that was found
+// after the last one. every bus access is one cycle and is done in the same
+// order as on the 6502.
+void CORE(step)(CORE_MACHINE* machine, Cpu_6502* cpu)
+{
+	Decoded_instruction d;
+	if (cpu->interrupt != interrupt_none) {
+		CORE(interrupt)(machine, cpu);
+		return;
+	}
+	CORE(decode)(machine, cpu, &d);
+	CORE(execute)(machine, cpu, &d);
+}
+
+#undef MEM_READ
+#undef MEM_WRITE
+#undef DEBUG_READ
+#undef PUSH_STACK
+#undef PULL_STACK
+#undef CORE
+#undef CORE_CAT
+#undef CORE_CAT_
+#undef CORE_DECIMAL
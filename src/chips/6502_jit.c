@@ -0,0 +1,527 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "../types.h"
+#include "../bitmath.h"
+#include "../systems/system.h"
+#include "2C02.h"
+#include "6502.h"
+#include "6502_jit.h"
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define JIT_ARENA_SIZE (4 * 1024 * 1024)
+// the most one instruction can take up in the arena, plus the block's epilogue
+#define JIT_MAX_EMIT 64
+
+typedef int (*Jit_code)(Jit* jit, Cpu_6502* cpu);
+
+typedef struct jit_block {
+	Jit_code code;
+	int length; // instructions
+	Decoded_instruction decoded[JIT_MAX_BLOCK];
+} Jit_block;
+
+typedef struct jit_page {
+	Jit_block* blocks[256];
+	byte heat[256];
+} Jit_page;
+
+struct jit {
+	// blocks, and the decoded instructions the generated code points at, are never
+	// freed on their own. the arena is only reset when translating, which is never
+	// done from inside a block. it's never writable and executable at once, the
+	// part a block's going into is only made writable while it's translated.
+	byte* arena;
+	size_t used;
+	byte* emit;
+	Jit_page* pages[256];
+	bool code_page[256];
+	int hot;
+	int block_limit;
+	// what the running block works on, for the instructions it hands back
+	System system;
+	Cpu_6502* cpu;
+	bool stop;
+};
+
+Jit* jit_create(void)
+{
+	Jit* jit = calloc(1, sizeof(Jit));
+	if (jit == NULL) {
+		printf("couldn't allocate memory\n");
+		return NULL;
+	}
+	jit->arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (jit->arena == MAP_FAILED) {
+		printf("couldn't map executable memory for the jit\n");
+		free(jit);
+		return NULL;
+	}
+	jit->hot = JIT_HOT;
+	jit->block_limit = JIT_MAX_BLOCK;
+	return jit;
+}
+
+void jit_destroy(Jit* jit)
+{
+	if (jit == NULL)
+		return;
+	munmap(jit->arena, JIT_ARENA_SIZE);
+	for (int i=0; i<256; i++)
+		free(jit->pages[i]);
+	free(jit);
+}
+
+void jit_set_code_pages(Jit* jit, int first_page, int last_page, bool code)
+{
+	for (int i=first_page; i<=last_page; i++)
+		jit->code_page[i] = code;
+	jit_invalidate(jit, first_page << 8, (last_page << 8) | 0xFF);
+}
+
+void jit_set_hot_threshold(Jit* jit, int threshold)
+{
+	jit->hot = threshold;
+}
+
+void jit_set_block_limit(Jit* jit, int instructions)
+{
+	if (instructions < 1 || JIT_MAX_BLOCK < instructions)
+		instructions = JIT_MAX_BLOCK;
+	jit->block_limit = instructions;
+	jit_invalidate(jit, 0, 0xFFFF);
+}
+
+void jit_invalidate(Jit* jit, word first, word last)
+{
+	// a block is at most JIT_MAX_BLOCK * 3 bytes long, so it can only reach into
+	// the page after the one it starts in
+	int first_page = (first >> 8) == 0 ? 0 : (first >> 8) - 1;
+	for (int i=first_page; i<=(last >> 8); i++) {
+		if (jit->pages[i] != NULL)
+			memset(jit->pages[i], 0, sizeof(Jit_page));
+	}
+	jit->stop = true;
+}
+
+void jit_stop(Jit* jit)
+{
+	jit->stop = true;
+}
+
+static void jit_flush(Jit* jit)
+{
+	for (int i=0; i<256; i++) {
+		if (jit->pages[i] != NULL)
+			memset(jit->pages[i]->blocks, 0, sizeof(jit->pages[i]->blocks));
+	}
+	jit->used = 0;
+}
+
+// instructions the generated code doesn't do itself. the inline ones don't
+// poll for interrupts, so the block stops once one could come in.
+static int jit_execute(Jit* jit, Decoded_instruction* d)
+{
+	jit->cpu->cycles += d->fetch_cycles;
+	execute(jit->system, jit->cpu, d);
+	return !jit->cpu->running || jit->stop || cpu_interrupt_possible(jit->cpu);
+}
+
+// x86-64 encoding. rbx holds the cpu, r12 the jit, and the guest registers stay
+// in the cpu struct so nothing has to be written back when calling out.
+
+static void emit8(Jit* jit, byte b)
+{
+	*jit->emit++ = b;
+}
+
+static void emit32(Jit* jit, uint32_t v)
+{
+	memcpy(jit->emit, &v, 4);
+	jit->emit += 4;
+}
+
+static void emit64(Jit* jit, uint64_t v)
+{
+	memcpy(jit->emit, &v, 8);
+	jit->emit += 8;
+}
+
+// modrm for [rbx + disp32]
+static void emit_field(Jit* jit, int reg, size_t field)
+{
+	emit8(jit, 0x83 | (reg << 3));
+	emit32(jit, field);
+}
+
+#define REG(r) (offsetof(Cpu_6502, reg) + (r))
+#define FLAG(f) offsetof(Cpu_6502, f)
+
+// mov al, [field]
+static void emit_load(Jit* jit, size_t field)
+{
+	emit8(jit, 0x8A);
+	emit_field(jit, 0, field);
+}
+
+// mov [field], al
+static void emit_store(Jit* jit, size_t field)
+{
+	emit8(jit, 0x88);
+	emit_field(jit, 0, field);
+}
+
+// mov byte [field], imm8
+static void emit_store_imm(Jit* jit, size_t field, byte value)
+{
+	emit8(jit, 0xC6);
+	emit_field(jit, 0, field);
+	emit8(jit, value);
+}
+
+static void emit_store_nz(Jit* jit)
+{
+	emit_store(jit, FLAG(flag_n));
+	emit_store(jit, FLAG(flag_z));
+}
+
+// setc / setnc byte [flag_c]
+static void emit_store_carry(Jit* jit, bool inverted)
+{
+	emit8(jit, 0x0F);
+	emit8(jit, inverted ? 0x93 : 0x92);
+	emit_field(jit, 0, FLAG(flag_c));
+}
+
+// <op> al, imm8
+static void emit_alu_imm(Jit* jit, byte opcode, byte value)
+{
+	emit8(jit, opcode);
+	emit8(jit, value);
+}
+
+// d0 /op, a shift or rotate by one of al (0) or cl (1)
+static void emit_shift(Jit* jit, int op, int reg)
+{
+	emit8(jit, 0xD0);
+	emit8(jit, 0xC0 | (op << 3) | reg);
+}
+
+static void emit_add_cycles(Jit* jit, int cycles)
+{
+	if (cycles == 0)
+		return;
+	// add qword [cycles], imm8
+	emit8(jit, 0x48);
+	emit8(jit, 0x83);
+	emit_field(jit, 0, FLAG(cycles));
+	emit8(jit, cycles);
+}
+
+static void emit_set_pc(Jit* jit, word pc)
+{
+	// mov word [pc], imm16
+	emit8(jit, 0x66);
+	emit8(jit, 0xC7);
+	emit_field(jit, 0, FLAG(pc));
+	emit8(jit, get_lower_byte(pc));
+	emit8(jit, get_higher_byte(pc));
+}
+
+static void emit_return(Jit* jit, byte* epilogue, int instructions)
+{
+	// mov eax, imm32; jmp epilogue
+	emit8(jit, 0xB8);
+	emit32(jit, instructions);
+	emit8(jit, 0xE9);
+	emit32(jit, (uint32_t) (epilogue - (jit->emit + 4)));
+}
+
+// the instructions translated inline, and what they become. returns false for
+// anything left to jit_execute().
+static bool emit_inline(Jit* jit, Decoded_instruction* d)
+{
+	if (d->a != immediate && d->a != implied && d->a != accumulator)
+		return false;
+	byte imm = d->oper[0];
+	switch (d->n) {
+	case LDA:
+	case LDX:
+	case LDY:
+		emit_store_imm(jit, REG(d->n == LDA ? reg_a : d->n == LDX ? reg_x : reg_y), imm);
+		emit_store_imm(jit, FLAG(flag_n), imm);
+		emit_store_imm(jit, FLAG(flag_z), imm);
+		return true;
+	case AND:
+	case ORA:
+	case EOR:
+		emit_load(jit, REG(reg_a));
+		emit_alu_imm(jit, d->n == AND ? 0x24 : d->n == ORA ? 0x0C : 0x34, imm);
+		emit_store(jit, REG(reg_a));
+		emit_store_nz(jit);
+		return true;
+	case CMP:
+	case CPX:
+	case CPY:
+		// sub al, imm8 borrows exactly when the 6502 clears carry
+		emit_load(jit, REG(d->n == CMP ? reg_a : d->n == CPX ? reg_x : reg_y));
+		emit_alu_imm(jit, 0x2C, imm);
+		emit_store_carry(jit, true);
+		emit_store_nz(jit);
+		return true;
+	case INX:
+	case INY:
+	case DEX:
+	case DEY: {
+		enum register_ r = (d->n == INX || d->n == DEX) ? reg_x : reg_y;
+		emit_load(jit, REG(r));
+		emit8(jit, 0xFE);
+		emit8(jit, (d->n == INX || d->n == INY) ? 0xC0 : 0xC8);
+		emit_store(jit, REG(r));
+		emit_store_nz(jit);
+		return true;
+	}
+	case TAX:
+	case TAY:
+	case TXA:
+	case TYA:
+	case TSX:
+	case TXS: {
+		enum register_ from[] = { [TAX] = reg_a, [TAY] = reg_a, [TXA] = reg_x, [TYA] = reg_y, [TSX] = reg_sp, [TXS] = reg_x };
+		enum register_ to[] = { [TAX] = reg_x, [TAY] = reg_y, [TXA] = reg_a, [TYA] = reg_a, [TSX] = reg_x, [TXS] = reg_sp };
+		emit_load(jit, REG(from[d->n]));
+		emit_store(jit, REG(to[d->n]));
+		if (d->n != TXS)
+			emit_store_nz(jit);
+		return true;
+	}
+	case ASL:
+	case LSR:
+	case ROL:
+	case ROR:
+		if (d->a != accumulator)
+			return false;
+		if (d->n == ROL || d->n == ROR) {
+			// shr cl, 1 puts the old carry into CF for rcl/rcr
+			emit8(jit, 0x8A);
+			emit_field(jit, 1, FLAG(flag_c));
+			emit_shift(jit, 5, 1);
+		}
+		emit_load(jit, REG(reg_a));
+		emit_shift(jit, d->n == ASL ? 4 : d->n == LSR ? 5 : d->n == ROL ? 2 : 3, 0);
+		emit_store_carry(jit, false);
+		emit_store(jit, REG(reg_a));
+		emit_store_nz(jit);
+		return true;
+	case CLC:
+	case SEC:
+		emit_store_imm(jit, FLAG(flag_c), d->n == SEC);
+		return true;
+	case CLV:
+		emit_store_imm(jit, FLAG(flag_v), 0);
+		return true;
+	case CLD:
+	case SED:
+		// and / or byte [p], imm8
+		emit8(jit, 0x80);
+		emit_field(jit, d->n == CLD ? 4 : 1, REG(reg_p));
+		emit8(jit, d->n == CLD ? (byte) ~0x08 : 0x08);
+		return true;
+	case NOP:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool ends_block(byte n)
+{
+	switch (n) {
+	case BCC: case BCS: case BNE: case BEQ:
+	case BPL: case BMI: case BVC: case BVS:
+	case JMP: case JSR: case RTS: case RTI:
+	case BRK:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// makes the pages of the arena from at for size bytes writable, or executable
+// again. returns false if they couldn't be changed.
+static bool jit_protect(Jit* jit, size_t at, size_t size, bool writable)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t first = at & ~(page - 1);
+	size_t end = (at + size + page - 1) & ~(page - 1);
+	if (JIT_ARENA_SIZE < end)
+		end = JIT_ARENA_SIZE;
+	return mprotect(jit->arena + first, end - first, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+}
+
+static Jit_block* jit_translate(Jit* jit, System system, Cpu_6502* cpu, word pc);
+
+// reads the code at pc without touching the cpu and translates it. returns NULL
+// when not even the first instruction can be translated.
+static Jit_block* jit_compile(Jit* jit, System system, Cpu_6502* cpu, word pc)
+{
+	size_t need = sizeof(Jit_block) + JIT_MAX_BLOCK * JIT_MAX_EMIT + 16;
+	if (JIT_ARENA_SIZE - jit->used < need)
+		jit_flush(jit);
+	size_t at = jit->used;
+	if (!jit_protect(jit, at, need, true))
+		return NULL;
+	Jit_block* b = jit_translate(jit, system, cpu, pc);
+	if (!jit_protect(jit, at, need, false)) {
+		// the pages are left writable, so nothing may run from them
+		printf("couldn't make the jit's code executable\n");
+		jit_flush(jit);
+		return NULL;
+	}
+	return b;
+}
+
+static Jit_block* jit_translate(Jit* jit, System system, Cpu_6502* cpu, word pc)
+{
+	Jit_block* b = (Jit_block*) (jit->arena + jit->used);
+	Cpu_6502 scratch = *cpu;
+	b->length = 0;
+	for (word at = pc; b->length < jit->block_limit; ) {
+		if (!jit->code_page[at >> 8] || !jit->code_page[(word) (at + 2) >> 8])
+			break;
+		Decoded_instruction* d = &b->decoded[b->length];
+		scratch.pc = at;
+		decode(system, &scratch, d);
+		if (d->n == unimplemented || d->n == JAM)
+			break;
+		b->length++;
+		at += d->length;
+		if (ends_block(d->n))
+			break;
+	}
+	if (b->length == 0)
+		return NULL;
+
+	byte* epilogue = jit->arena + jit->used + sizeof(Jit_block);
+	jit->emit = epilogue;
+	// add rsp, 8; pop r12; pop rbx; ret
+	emit8(jit, 0x48); emit8(jit, 0x83); emit8(jit, 0xC4); emit8(jit, 0x08);
+	emit8(jit, 0x41); emit8(jit, 0x5C);
+	emit8(jit, 0x5B);
+	emit8(jit, 0xC3);
+
+	b->code = (Jit_code) jit->emit;
+	// push rbx; push r12; sub rsp, 8; mov rbx, rsi; mov r12, rdi
+	emit8(jit, 0x53);
+	emit8(jit, 0x41); emit8(jit, 0x54);
+	emit8(jit, 0x48); emit8(jit, 0x83); emit8(jit, 0xEC); emit8(jit, 0x08);
+	emit8(jit, 0x48); emit8(jit, 0x89); emit8(jit, 0xF3);
+	emit8(jit, 0x49); emit8(jit, 0x89); emit8(jit, 0xFC);
+
+	word at = pc;
+	int cycles = 0;
+	for (int i=0; i<b->length; i++) {
+		Decoded_instruction* d = &b->decoded[i];
+		if (emit_inline(jit, d)) {
+			cycles += d->fetch_cycles;
+			at += d->length;
+			continue;
+		}
+		emit_add_cycles(jit, cycles);
+		cycles = 0;
+		emit_set_pc(jit, at);
+		// mov rdi, r12; mov rsi, d; mov rax, jit_execute; call rax
+		emit8(jit, 0x4C); emit8(jit, 0x89); emit8(jit, 0xE7);
+		emit8(jit, 0x48); emit8(jit, 0xBE); emit64(jit, (uint64_t) (uintptr_t) d);
+		emit8(jit, 0x48); emit8(jit, 0xB8); emit64(jit, (uint64_t) (uintptr_t) jit_execute);
+		emit8(jit, 0xFF); emit8(jit, 0xD0);
+		if (i != b->length - 1) {
+			// test eax, eax; jz past the return
+			emit8(jit, 0x85); emit8(jit, 0xC0);
+			emit8(jit, 0x74); emit8(jit, 10);
+			emit_return(jit, epilogue, i + 1);
+		}
+		at += d->length;
+	}
+	emit_add_cycles(jit, cycles);
+	if (cycles != 0)
+		emit_set_pc(jit, at);
+	emit_return(jit, epilogue, b->length);
+
+	jit->used = (jit->emit - jit->arena + 15) & ~(size_t) 15;
+	return b;
+}
+
+int jit_run(Jit* jit, System system, Cpu_6502* cpu, int max_instructions)
+{
+	word pc = cpu->pc;
+	if (!jit->code_page[pc >> 8] || cpu_interrupt_possible(cpu))
+		return 0;
+	if (jit->pages[pc >> 8] == NULL) {
+		jit->pages[pc >> 8] = calloc(1, sizeof(Jit_page));
+		if (jit->pages[pc >> 8] == NULL)
+			return 0;
+	}
+	Jit_page* page = jit->pages[pc >> 8];
+	Jit_block* b = page->blocks[pc & 0xFF];
+	if (b == NULL) {
+		if (page->heat[pc & 0xFF] < jit->hot) {
+			page->heat[pc & 0xFF]++;
+			return 0;
+		}
+		b = jit_compile(jit, system, cpu, pc);
+		if (b == NULL)
+			return 0;
+		page->blocks[pc & 0xFF] = b;
+	}
+	if (max_instructions < b->length)
+		return 0;
+	jit->system = system;
+	jit->cpu = cpu;
+	jit->stop = false;
+	return b->code(jit, cpu);
+}
+
+#else
+
+Jit* jit_create(void)
+{
+	return NULL;
+}
+
+void jit_destroy(Jit* jit)
+{
+}
+
+void jit_set_code_pages(Jit* jit, int first_page, int last_page, bool code)
+{
+}
+
+void jit_set_hot_threshold(Jit* jit, int threshold)
+{
+}
+
+void jit_set_block_limit(Jit* jit, int instructions)
+{
+}
+
+void jit_stop(Jit* jit)
+{
+}
+
+void jit_invalidate(Jit* jit, word first, word last)
+{
+}
+
+int jit_run(Jit* jit, System system, Cpu_6502* cpu, int max_instructions)
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,28 @@
+// translates straight-line runs of 6502 code into x86-64 machine code. register,
+// flag and immediate instructions are emitted inline, everything that touches
+// the bus calls back into execute() so its timing and side effects are the
+// interpreter's. only available on x86-64, jit_create() returns NULL elsewhere.
+
+#define JIT_MAX_BLOCK 32 // instructions
+#define JIT_HOT 8 // times a block's start has to be reached before it's translated
+
+typedef struct jit Jit;
+
+Jit* jit_create(void);
+void jit_destroy(Jit* jit);
+// code is only translated from pages marked with this, the rest is left to the
+// interpreter. mark only memory that can't change under the block without the
+// system calling jit_invalidate() first.
+void jit_set_code_pages(Jit* jit, int first_page, int last_page, bool code);
+void jit_set_hot_threshold(Jit* jit, int threshold);
+void jit_set_block_limit(Jit* jit, int instructions);
+// drops every block that could contain an address between first and last. safe to
+// call from inside a block, which then returns after the current instruction.
+void jit_invalidate(Jit* jit, word first, word last);
+// makes the running block return after the current instruction, for when
+// something it did has to be handled between instructions, like an interrupt
+void jit_stop(Jit* jit);
+// runs the block starting at cpu->pc if there is one of at most max_instructions
+// and returns how many instructions it ran, or 0 if the caller has to interpret.
+// nothing is run while cpu_interrupt_possible(), the interpreter does the polling.
+int jit_run(Jit* jit, System system, Cpu_6502* cpu, int max_instructions);
@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "types.h"
+#include "chips/2C02.h"
+#include "frames.h"
+
+void frames_init(Frames* f)
+{
+	memset(f->screens, 0, sizeof(f->screens));
+	memset(f->input_time, 0, sizeof(f->input_time));
+	f->back = 0;
+	f->front = 1;
+	atomic_store(&f->middle, 2);
+}
+
+// hands back over as the newest frame, drawing carries on in the one it replaces
+void frames_publish(Frames* f)
+{
+	f->back = atomic_exchange_explicit(&f->middle, f->back | FRAMES_FRESH, memory_order_acq_rel) & ~FRAMES_FRESH;
+}
+
+// moves the newest frame to front, returns false if there wasn't a new one
+bool frames_take(Frames* f)
+{
+	if (!(atomic_load_explicit(&f->middle, memory_order_relaxed) & FRAMES_FRESH))
+		return false;
+	f->front = atomic_exchange_explicit(&f->middle, f->front, memory_order_acq_rel) & ~FRAMES_FRESH;
+	return true;
+}
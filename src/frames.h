@@ -0,0 +1,18 @@
+// finished screens go from the emulation thread to the one presenting them
+// through three buffers. the emulation draws into back, and swaps it with
+// middle when it's done. the presenter swaps front with middle when there's a
+// new one, so it always gets the newest frame and neither side waits.
+
+#define FRAMES_FRESH 4 // set in middle until the presenter takes it
+
+typedef struct frames {
+	word screens[3][PPU_HEIGHT][PPU_WIDTH];
+	uint64_t input_time[3]; // of the input first seen in each, 0 if none
+	int back;
+	int front;
+	_Atomic int middle;
+} Frames;
+
+void frames_init(Frames* f);
+void frames_publish(Frames* f);
+bool frames_take(Frames* f);
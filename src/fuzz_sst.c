@@ -0,0 +1,1001 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "types.h"
+
+#include "systems/system.h"
+#include "chips/6502.h"
+#include "chips/6502_jit.h"
+#include "systems/sst.h"
+
+// differential fuzzer for the 6502 core: random cpu state and memory are run
+// through sst_cpu_step() and through the reference model below, which follows
+// the bus cycles of a real nmos 6502 one access at a time.
+//
+// standalone: bin/fuzz_sst [-j threads] [-n cases] [-t seconds] [-o opcode] [-s seed] [-w] [-J]
+// libfuzzer:  make fuzz_sst_libfuzzer && bin/fuzz_sst_libfuzzer
+
+enum ref_mode {
+	m_imp, m_acc, m_imm, m_zp, m_zpx, m_zpy, m_izx, m_izy,
+	m_abs, m_abx, m_aby, m_ind, m_rel,
+};
+
+enum ref_op {
+	r_none,
+	r_adc, r_and, r_asl, r_bcc, r_bcs, r_beq, r_bit, r_bmi,
+	r_bne, r_bpl, r_brk, r_bvc, r_bvs, r_clc, r_cld, r_cli,
+	r_clv, r_cmp, r_cpx, r_cpy, r_dec, r_dex, r_dey, r_eor,
+	r_inc, r_inx, r_iny, r_jmp, r_jsr, r_lda, r_ldx, r_ldy,
+	r_lsr, r_nop, r_ora, r_pha, r_php, r_pla, r_plp, r_rol,
+	r_ror, r_rti, r_rts, r_sbc, r_sec, r_sed, r_sei, r_sta,
+	r_stx, r_sty, r_tax, r_tay, r_tsx, r_txa, r_txs, r_tya,
+	r_slo, r_rla, r_sre, r_rra, r_sax, r_lax, r_dcp, r_isc,
+	r_anc, r_alr, r_arr, r_ane, r_lxa, r_sbx, r_sha, r_shx,
+	r_shy, r_tas, r_las,
+};
+
+typedef struct ref_opcode {
+	byte op;
+	byte mode;
+} Ref_opcode;
+
+#define OP(o, m) { r_##o, m_##m }
+static const Ref_opcode ref_opcodes[256] = {
+	[0x00] = OP(brk, imp), [0x01] = OP(ora, izx), [0x05] = OP(ora, zp),  [0x06] = OP(asl, zp),
+	[0x08] = OP(php, imp), [0x09] = OP(ora, imm), [0x0A] = OP(asl, acc), [0x0D] = OP(ora, abs),
+	[0x0E] = OP(asl, abs), [0x10] = OP(bpl, rel), [0x11] = OP(ora, izy), [0x15] = OP(ora, zpx),
+	[0x16] = OP(asl, zpx), [0x18] = OP(clc, imp), [0x19] = OP(ora, aby), [0x1D] = OP(ora, abx),
+	[0x1E] = OP(asl, abx), [0x20] = OP(jsr, abs), [0x21] = OP(and, izx), [0x24] = OP(bit, zp),
+	[0x25] = OP(and, zp),  [0x26] = OP(rol, zp),  [0x28] = OP(plp, imp), [0x29] = OP(and, imm),
+	[0x2A] = OP(rol, acc), [0x2C] = OP(bit, abs), [0x2D] = OP(and, abs), [0x2E] = OP(rol, abs),
+	[0x30] = OP(bmi, rel), [0x31] = OP(and, izy), [0x35] = OP(and, zpx), [0x36] = OP(rol, zpx),
+	[0x38] = OP(sec, imp), [0x39] = OP(and, aby), [0x3D] = OP(and, abx), [0x3E] = OP(rol, abx),
+	[0x40] = OP(rti, imp), [0x41] = OP(eor, izx), [0x45] = OP(eor, zp),  [0x46] = OP(lsr, zp),
+	[0x48] = OP(pha, imp), [0x49] = OP(eor, imm), [0x4A] = OP(lsr, acc), [0x4C] = OP(jmp, abs),
+	[0x4D] = OP(eor, abs), [0x4E] = OP(lsr, abs), [0x50] = OP(bvc, rel), [0x51] = OP(eor, izy),
+	[0x55] = OP(eor, zpx), [0x56] = OP(lsr, zpx), [0x58] = OP(cli, imp), [0x59] = OP(eor, aby),
+	[0x5D] = OP(eor, abx), [0x5E] = OP(lsr, abx), [0x60] = OP(rts, imp), [0x61] = OP(adc, izx),
+	[0x65] = OP(adc, zp),  [0x66] = OP(ror, zp),  [0x68] = OP(pla, imp), [0x69] = OP(adc, imm),
+	[0x6A] = OP(ror, acc), [0x6C] = OP(jmp, ind), [0x6D] = OP(adc, abs), [0x6E] = OP(ror, abs),
+	[0x70] = OP(bvs, rel), [0x71] = OP(adc, izy), [0x75] = OP(adc, zpx), [0x76] = OP(ror, zpx),
+	[0x78] = OP(sei, imp), [0x79] = OP(adc, aby), [0x7D] = OP(adc, abx), [0x7E] = OP(ror, abx),
+	[0x81] = OP(sta, izx), [0x84] = OP(sty, zp),  [0x85] = OP(sta, zp),  [0x86] = OP(stx, zp),
+	[0x88] = OP(dey, imp), [0x8A] = OP(txa, imp), [0x8C] = OP(sty, abs), [0x8D] = OP(sta, abs),
+	[0x8E] = OP(stx, abs), [0x90] = OP(bcc, rel), [0x91] = OP(sta, izy), [0x94] = OP(sty, zpx),
+	[0x95] = OP(sta, zpx), [0x96] = OP(stx, zpy), [0x98] = OP(tya, imp), [0x99] = OP(sta, aby),
+	[0x9A] = OP(txs, imp), [0x9D] = OP(sta, abx), [0xA0] = OP(ldy, imm), [0xA1] = OP(lda, izx),
+	[0xA2] = OP(ldx, imm), [0xA4] = OP(ldy, zp),  [0xA5] = OP(lda, zp),  [0xA6] = OP(ldx, zp),
+	[0xA8] = OP(tay, imp), [0xA9] = OP(lda, imm), [0xAA] = OP(tax, imp), [0xAC] = OP(ldy, abs),
+	[0xAD] = OP(lda, abs), [0xAE] = OP(ldx, abs), [0xB0] = OP(bcs, rel), [0xB1] = OP(lda, izy),
+	[0xB4] = OP(ldy, zpx), [0xB5] = OP(lda, zpx), [0xB6] = OP(ldx, zpy), [0xB8] = OP(clv, imp),
+	[0xB9] = OP(lda, aby), [0xBA] = OP(tsx, imp), [0xBC] = OP(ldy, abx), [0xBD] = OP(lda, abx),
+	[0xBE] = OP(ldx, aby), [0xC0] = OP(cpy, imm), [0xC1] = OP(cmp, izx), [0xC4] = OP(cpy, zp),
+	[0xC5] = OP(cmp, zp),  [0xC6] = OP(dec, zp),  [0xC8] = OP(iny, imp), [0xC9] = OP(cmp, imm),
+	[0xCA] = OP(dex, imp), [0xCC] = OP(cpy, abs), [0xCD] = OP(cmp, abs), [0xCE] = OP(dec, abs),
+	[0xD0] = OP(bne, rel), [0xD1] = OP(cmp, izy), [0xD5] = OP(cmp, zpx), [0xD6] = OP(dec, zpx),
+	[0xD8] = OP(cld, imp), [0xD9] = OP(cmp, aby), [0xDD] = OP(cmp, abx), [0xDE] = OP(dec, abx),
+	[0xE0] = OP(cpx, imm), [0xE1] = OP(sbc, izx), [0xE4] = OP(cpx, zp),  [0xE5] = OP(sbc, zp),
+	[0xE6] = OP(inc, zp),  [0xE8] = OP(inx, imp), [0xE9] = OP(sbc, imm), [0xEA] = OP(nop, imp),
+	[0xEC] = OP(cpx, abs), [0xED] = OP(sbc, abs), [0xEE] = OP(inc, abs), [0xF0] = OP(beq, rel),
+	[0xF1] = OP(sbc, izy), [0xF5] = OP(sbc, zpx), [0xF6] = OP(inc, zpx), [0xF8] = OP(sed, imp),
+	[0xF9] = OP(sbc, aby), [0xFD] = OP(sbc, abx), [0xFE] = OP(inc, abx),
+	// undocumented, the jams are left out
+	[0x03] = OP(slo, izx), [0x04] = OP(nop, zp),  [0x07] = OP(slo, zp),  [0x0B] = OP(anc, imm),
+	[0x0C] = OP(nop, abs), [0x0F] = OP(slo, abs), [0x13] = OP(slo, izy), [0x14] = OP(nop, zpx),
+	[0x17] = OP(slo, zpx), [0x1A] = OP(nop, imp), [0x1B] = OP(slo, aby), [0x1C] = OP(nop, abx),
+	[0x1F] = OP(slo, abx), [0x23] = OP(rla, izx), [0x27] = OP(rla, zp),  [0x2B] = OP(anc, imm),
+	[0x2F] = OP(rla, abs), [0x33] = OP(rla, izy), [0x34] = OP(nop, zpx), [0x37] = OP(rla, zpx),
+	[0x3A] = OP(nop, imp), [0x3B] = OP(rla, aby), [0x3C] = OP(nop, abx), [0x3F] = OP(rla, abx),
+	[0x43] = OP(sre, izx), [0x44] = OP(nop, zp),  [0x47] = OP(sre, zp),  [0x4B] = OP(alr, imm),
+	[0x4F] = OP(sre, abs), [0x53] = OP(sre, izy), [0x54] = OP(nop, zpx), [0x57] = OP(sre, zpx),
+	[0x5A] = OP(nop, imp), [0x5B] = OP(sre, aby), [0x5C] = OP(nop, abx), [0x5F] = OP(sre, abx),
+	[0x63] = OP(rra, izx), [0x64] = OP(nop, zp),  [0x67] = OP(rra, zp),  [0x6B] = OP(arr, imm),
+	[0x6F] = OP(rra, abs), [0x73] = OP(rra, izy), [0x74] = OP(nop, zpx), [0x77] = OP(rra, zpx),
+	[0x7A] = OP(nop, imp), [0x7B] = OP(rra, aby), [0x7C] = OP(nop, abx), [0x7F] = OP(rra, abx),
+	[0x80] = OP(nop, imm), [0x82] = OP(nop, imm), [0x83] = OP(sax, izx), [0x87] = OP(sax, zp),
+	[0x89] = OP(nop, imm), [0x8B] = OP(ane, imm), [0x8F] = OP(sax, abs), [0x93] = OP(sha, izy),
+	[0x97] = OP(sax, zpy), [0x9B] = OP(tas, aby), [0x9C] = OP(shy, abx), [0x9E] = OP(shx, aby),
+	[0x9F] = OP(sha, aby), [0xA3] = OP(lax, izx), [0xA7] = OP(lax, zp),  [0xAB] = OP(lxa, imm),
+	[0xAF] = OP(lax, abs), [0xB3] = OP(lax, izy), [0xB7] = OP(lax, zpy), [0xBB] = OP(las, aby),
+	[0xBF] = OP(lax, aby), [0xC2] = OP(nop, imm), [0xC3] = OP(dcp, izx), [0xC7] = OP(dcp, zp),
+	[0xCB] = OP(sbx, imm), [0xCF] = OP(dcp, abs), [0xD3] = OP(dcp, izy), [0xD4] = OP(nop, zpx),
+	[0xD7] = OP(dcp, zpx), [0xDA] = OP(nop, imp), [0xDB] = OP(dcp, aby), [0xDC] = OP(nop, abx),
+	[0xDF] = OP(dcp, abx), [0xE2] = OP(nop, imm), [0xE3] = OP(isc, izx), [0xE7] = OP(isc, zp),
+	[0xEB] = OP(sbc, imm), [0xEF] = OP(isc, abs), [0xF3] = OP(isc, izy), [0xF4] = OP(nop, zpx),
+	[0xF7] = OP(isc, zpx), [0xFA] = OP(nop, imp), [0xFB] = OP(isc, aby), [0xFC] = OP(nop, abx),
+	[0xFF] = OP(isc, abx),
+};
+#undef OP
+
+typedef struct ref_cpu {
+	word pc;
+	byte a, x, y, s, p;
+	const byte* ram;
+	Sst_cycle cycles[SST_MAX_CYCLES];
+	int cycle_count;
+} Ref_cpu;
+
+static void ref_log(Ref_cpu* r, word addr, byte value, bool write)
+{
+	if (r->cycle_count < SST_MAX_CYCLES) {
+		r->cycles[r->cycle_count].addr = addr;
+		r->cycles[r->cycle_count].value = value;
+		r->cycles[r->cycle_count].write = write;
+	}
+	r->cycle_count++;
+}
+
+// value of addr after the cycles logged so far, the ram image itself is never written
+static byte ref_peek(Ref_cpu* r, word addr)
+{
+	for (int i=r->cycle_count-1; 0<=i; i--) {
+		if (r->cycles[i].write && r->cycles[i].addr == addr)
+			return r->cycles[i].value;
+	}
+	return r->ram[addr];
+}
+
+static byte ref_read(Ref_cpu* r, word addr)
+{
+	byte value = ref_peek(r, addr);
+	ref_log(r, addr, value, false);
+	return value;
+}
+
+static void ref_write(Ref_cpu* r, word addr, byte value)
+{
+	ref_log(r, addr, value, true);
+}
+
+static byte ref_nz(Ref_cpu* r, byte value)
+{
+	r->p = (r->p & ~0x82) | (value & 0x80) | (value == 0 ? 0x02 : 0);
+	return value;
+}
+
+static void ref_push(Ref_cpu* r, byte value)
+{
+	ref_write(r, 0x100 | r->s, value);
+	r->s--;
+}
+
+static byte ref_pull(Ref_cpu* r)
+{
+	r->s++;
+	return ref_read(r, 0x100 | r->s);
+}
+
+static void ref_adc(Ref_cpu* r, byte m)
+{
+	int sum = r->a + m + (r->p & 0x01);
+	byte result = sum;
+	r->p = (r->p & ~0x41) | (0xFF < sum ? 0x01 : 0) | (((r->a ^ result) & (m ^ result) & 0x80) ? 0x40 : 0);
+	r->a = ref_nz(r, result);
+}
+
+// decimal mode as given in bruce clark's "decimal mode" tutorial, sequences 1
+// and 2 for adc and 3 for sbc. z is always from the binary result.
+static void ref_adc_decimal(Ref_cpu* r, byte m)
+{
+	int c = r->p & 0x01;
+	int al = (r->a & 0x0F) + (m & 0x0F) + c;
+	if (0x0A <= al)
+		al = ((al + 0x06) & 0x0F) + 0x10;
+	int a = (r->a & 0xF0) + (m & 0xF0) + al;
+	int signed_a = (int8_t)(r->a & 0xF0) + (int8_t)(m & 0xF0) + al;
+	r->p &= ~0xC3;
+	r->p |= (byte)(r->a + m + c) == 0 ? 0x02 : 0;
+	r->p |= signed_a & 0x80;
+	r->p |= signed_a < -128 || 127 < signed_a ? 0x40 : 0;
+	if (0xA0 <= a)
+		a += 0x60;
+	r->p |= 0x100 <= a ? 0x01 : 0;
+	r->a = a;
+}
+
+static void ref_sbc(Ref_cpu* r, byte m)
+{
+	byte a = r->a;
+	int c = r->p & 0x01;
+	ref_adc(r, ~m);
+	if (!(r->p & 0x08))
+		return;
+	int al = (a & 0x0F) - (m & 0x0F) + c - 1;
+	if (al < 0)
+		al = ((al - 0x06) & 0x0F) - 0x10;
+	int result = (a & 0xF0) - (m & 0xF0) + al;
+	if (result < 0)
+		result -= 0x60;
+	r->a = result;
+}
+
+static void ref_add(Ref_cpu* r, byte m)
+{
+	if (r->p & 0x08)
+		ref_adc_decimal(r, m);
+	else
+		ref_adc(r, m);
+}
+
+static void ref_compare(Ref_cpu* r, byte reg, byte m)
+{
+	r->p = (r->p & ~0x01) | (m <= reg ? 0x01 : 0);
+	ref_nz(r, reg - m);
+}
+
+static void ref_branch(Ref_cpu* r, byte offset, bool taken)
+{
+	r->pc += 2;
+	if (!taken)
+		return;
+	word target = r->pc + (int8_t)offset;
+	ref_read(r, r->pc);
+	if ((target & 0xFF00) != (r->pc & 0xFF00))
+		ref_read(r, (r->pc & 0xFF00) | (target & 0xFF));
+	r->pc = target;
+}
+
+static void ref_step(Ref_cpu* r)
+{
+	byte opcode = ref_read(r, r->pc);
+	const Ref_opcode* o = &ref_opcodes[opcode];
+	// the byte after the opcode is always read, even by one byte instructions
+	byte b1 = ref_read(r, r->pc + 1);
+	word ea = 0;
+	word base = 0; // set by the indexed modes, the only ones sh* has
+	byte value = 0;
+	byte result;
+	bool store = false;
+	bool rmw = false;
+
+	switch (o->op) {
+	case r_sta: case r_stx: case r_sty: case r_sax:
+	case r_sha: case r_shx: case r_shy: case r_tas:
+		store = true;
+		break;
+	case r_asl: case r_lsr: case r_rol: case r_ror: case r_inc: case r_dec:
+	case r_slo: case r_rla: case r_sre: case r_rra: case r_dcp: case r_isc:
+		rmw = o->mode != m_acc;
+		break;
+	}
+
+	switch (o->op) {
+	case r_brk:
+		ref_push(r, (r->pc + 2) >> 8);
+		ref_push(r, r->pc + 2);
+		ref_push(r, r->p | 0x30);
+		r->p |= 0x04;
+		r->pc = ref_read(r, 0xFFFE);
+		r->pc |= ref_read(r, 0xFFFF) << 8;
+		return;
+	case r_jsr:
+		ref_read(r, 0x100 | r->s);
+		ref_push(r, (r->pc + 2) >> 8);
+		ref_push(r, r->pc + 2);
+		r->pc = b1 | (ref_read(r, r->pc + 2) << 8);
+		return;
+	case r_rts:
+		ref_read(r, 0x100 | r->s);
+		r->pc = ref_pull(r);
+		r->pc |= ref_pull(r) << 8;
+		ref_read(r, r->pc);
+		r->pc++;
+		return;
+	case r_rti:
+		ref_read(r, 0x100 | r->s);
+		r->p = (ref_pull(r) | 0x20) & ~0x10;
+		r->pc = ref_pull(r);
+		r->pc |= ref_pull(r) << 8;
+		return;
+	case r_pha:
+		ref_push(r, r->a);
+		r->pc++;
+		return;
+	case r_php:
+		ref_push(r, r->p | 0x30);
+		r->pc++;
+		return;
+	case r_pla:
+		ref_read(r, 0x100 | r->s);
+		r->a = ref_nz(r, ref_pull(r));
+		r->pc++;
+		return;
+	case r_plp:
+		ref_read(r, 0x100 | r->s);
+		r->p = (ref_pull(r) | 0x20) & ~0x10;
+		r->pc++;
+		return;
+	}
+
+	switch (o->mode) {
+	case m_imp:
+	case m_acc:
+		r->pc += 1;
+		break;
+	case m_imm:
+		r->pc += 2;
+		break;
+	case m_zp:
+		ea = b1;
+		r->pc += 2;
+		break;
+	case m_zpx:
+		ref_read(r, b1);
+		ea = (byte)(b1 + r->x);
+		r->pc += 2;
+		break;
+	case m_zpy:
+		ref_read(r, b1);
+		ea = (byte)(b1 + r->y);
+		r->pc += 2;
+		break;
+	case m_izx:
+		ref_read(r, b1);
+		ea = ref_read(r, (byte)(b1 + r->x));
+		ea |= ref_read(r, (byte)(b1 + r->x + 1)) << 8;
+		r->pc += 2;
+		break;
+	case m_izy:
+		base = ref_read(r, b1);
+		base |= ref_read(r, (byte)(b1 + 1)) << 8;
+		ea = base + r->y;
+		if (store || rmw || (ea & 0xFF00) != (base & 0xFF00))
+			ref_read(r, (base & 0xFF00) | (ea & 0xFF));
+		r->pc += 2;
+		break;
+	case m_abs:
+		ea = b1 | (ref_read(r, r->pc + 2) << 8);
+		r->pc += 3;
+		break;
+	case m_abx:
+	case m_aby:
+		base = b1 | (ref_read(r, r->pc + 2) << 8);
+		ea = base + (o->mode == m_abx ? r->x : r->y);
+		if (store || rmw || (ea & 0xFF00) != (base & 0xFF00))
+			ref_read(r, (base & 0xFF00) | (ea & 0xFF));
+		r->pc += 3;
+		break;
+	case m_ind:
+		base = b1 | (ref_read(r, r->pc + 2) << 8);
+		ea = ref_read(r, base);
+		ea |= ref_read(r, (base & 0xFF00) | ((base + 1) & 0xFF)) << 8;
+		r->pc += 3;
+		break;
+	case m_rel:
+		break;
+	}
+
+	if (store) {
+		switch (o->op) {
+		case r_sta: value = r->a; break;
+		case r_stx: value = r->x; break;
+		case r_sty: value = r->y; break;
+		case r_sax: value = r->a & r->x; break;
+		default:
+			// sh*: and'ed with the base's high byte + 1, which becomes the high
+			// byte of the address when indexing carries into it
+			if (o->op == r_tas)
+				r->s = r->a & r->x;
+			value = o->op == r_shx ? r->x : o->op == r_shy ? r->y : r->a & r->x;
+			value &= (base >> 8) + 1;
+			if ((ea & 0xFF00) != (base & 0xFF00))
+				ea = (value << 8) | (ea & 0xFF);
+			break;
+		}
+		ref_write(r, ea, value);
+		return;
+	}
+	if (rmw) {
+		value = ref_read(r, ea);
+		ref_write(r, ea, value);
+	} else if (o->mode == m_acc) {
+		value = r->a;
+	} else if (o->mode == m_imm) {
+		value = b1;
+	} else if (o->mode != m_imp && o->mode != m_rel && o->op != r_jmp) {
+		value = ref_read(r, ea);
+	}
+
+	switch (o->op) {
+	case r_adc: ref_add(r, value); break;
+	case r_sbc: ref_sbc(r, value); break;
+	case r_and: r->a = ref_nz(r, r->a & value); break;
+	case r_ora: r->a = ref_nz(r, r->a | value); break;
+	case r_eor: r->a = ref_nz(r, r->a ^ value); break;
+	case r_lda: r->a = ref_nz(r, value); break;
+	case r_ldx: r->x = ref_nz(r, value); break;
+	case r_ldy: r->y = ref_nz(r, value); break;
+	case r_cmp: ref_compare(r, r->a, value); break;
+	case r_cpx: ref_compare(r, r->x, value); break;
+	case r_cpy: ref_compare(r, r->y, value); break;
+	case r_bit:
+		r->p = (r->p & ~0xC2) | (value & 0xC0) | ((r->a & value) == 0 ? 0x02 : 0);
+		break;
+	case r_asl:
+		r->p = (r->p & ~0x01) | (value >> 7);
+		result = ref_nz(r, value << 1);
+		goto rmw_result;
+	case r_lsr:
+		r->p = (r->p & ~0x01) | (value & 0x01);
+		result = ref_nz(r, value >> 1);
+		goto rmw_result;
+	case r_rol:
+		result = ref_nz(r, (value << 1) | (r->p & 0x01));
+		r->p = (r->p & ~0x01) | (value >> 7);
+		goto rmw_result;
+	case r_ror:
+		result = ref_nz(r, (value >> 1) | ((r->p & 0x01) << 7));
+		r->p = (r->p & ~0x01) | (value & 0x01);
+		goto rmw_result;
+	case r_inc:
+		result = ref_nz(r, value + 1);
+		goto rmw_result;
+	case r_dec:
+		result = ref_nz(r, value - 1);
+		goto rmw_result;
+	case r_inx: r->x = ref_nz(r, r->x + 1); break;
+	case r_iny: r->y = ref_nz(r, r->y + 1); break;
+	case r_dex: r->x = ref_nz(r, r->x - 1); break;
+	case r_dey: r->y = ref_nz(r, r->y - 1); break;
+	case r_tax: r->x = ref_nz(r, r->a); break;
+	case r_tay: r->y = ref_nz(r, r->a); break;
+	case r_txa: r->a = ref_nz(r, r->x); break;
+	case r_tya: r->a = ref_nz(r, r->y); break;
+	case r_tsx: r->x = ref_nz(r, r->s); break;
+	case r_txs: r->s = r->x; break;
+	case r_clc: r->p &= ~0x01; break;
+	case r_sec: r->p |= 0x01; break;
+	case r_cli: r->p &= ~0x04; break;
+	case r_sei: r->p |= 0x04; break;
+	case r_cld: r->p &= ~0x08; break;
+	case r_sed: r->p |= 0x08; break;
+	case r_clv: r->p &= ~0x40; break;
+	case r_jmp: r->pc = ea; break;
+	case r_bpl: ref_branch(r, b1, !(r->p & 0x80)); break;
+	case r_bmi: ref_branch(r, b1, r->p & 0x80); break;
+	case r_bvc: ref_branch(r, b1, !(r->p & 0x40)); break;
+	case r_bvs: ref_branch(r, b1, r->p & 0x40); break;
+	case r_bcc: ref_branch(r, b1, !(r->p & 0x01)); break;
+	case r_bcs: ref_branch(r, b1, r->p & 0x01); break;
+	case r_bne: ref_branch(r, b1, !(r->p & 0x02)); break;
+	case r_beq: ref_branch(r, b1, r->p & 0x02); break;
+	case r_slo:
+		r->p = (r->p & ~0x01) | (value >> 7);
+		result = value << 1;
+		r->a = ref_nz(r, r->a | result);
+		goto rmw_result;
+	case r_rla:
+		result = (value << 1) | (r->p & 0x01);
+		r->p = (r->p & ~0x01) | (value >> 7);
+		r->a = ref_nz(r, r->a & result);
+		goto rmw_result;
+	case r_sre:
+		r->p = (r->p & ~0x01) | (value & 0x01);
+		result = value >> 1;
+		r->a = ref_nz(r, r->a ^ result);
+		goto rmw_result;
+	case r_rra:
+		result = (value >> 1) | ((r->p & 0x01) << 7);
+		r->p = (r->p & ~0x01) | (value & 0x01);
+		ref_write(r, ea, result);
+		ref_add(r, result);
+		return;
+	case r_dcp:
+		result = value - 1;
+		ref_compare(r, r->a, result);
+		goto rmw_result;
+	case r_isc:
+		result = value + 1;
+		ref_write(r, ea, result);
+		ref_sbc(r, result);
+		return;
+	case r_lax: r->a = r->x = ref_nz(r, value); break;
+	case r_las: r->a = r->x = r->s = ref_nz(r, value & r->s); break;
+	case r_anc:
+		r->a = ref_nz(r, r->a & value);
+		r->p = (r->p & ~0x01) | (r->a >> 7);
+		break;
+	case r_alr:
+		value &= r->a;
+		r->p = (r->p & ~0x01) | (value & 0x01);
+		r->a = ref_nz(r, value >> 1);
+		break;
+	case r_arr:
+		// from "no more secrets", the decimal fixup is done on the and'ed value
+		value &= r->a;
+		result = (value >> 1) | ((r->p & 0x01) << 7);
+		ref_nz(r, result);
+		if (!(r->p & 0x08)) {
+			r->p = (r->p & ~0x41) | ((result >> 6) & 0x01) | ((result ^ (result << 1)) & 0x40);
+			r->a = result;
+			break;
+		}
+		r->p = (r->p & ~0x41) | ((value ^ result) & 0x40);
+		if (5 < (value & 0x0F) + (value & 0x01))
+			result = (result & 0xF0) | ((result + 6) & 0x0F);
+		if (0x50 < (value & 0xF0) + (value & 0x10)) {
+			r->p |= 0x01;
+			result += 0x60;
+		}
+		r->a = result;
+		break;
+	case r_ane: r->a = ref_nz(r, (r->a | 0xEE) & r->x & value); break;
+	case r_lxa: r->a = r->x = ref_nz(r, (r->a | 0xEE) & value); break;
+	case r_sbx:
+		ref_compare(r, r->a & r->x, value);
+		r->x = (r->a & r->x) - value;
+		break;
+	default:
+		break;
+	}
+	return;
+rmw_result:
+	if (rmw)
+		ref_write(r, ea, result);
+	else
+		r->a = result;
+}
+
+typedef struct fuzz_case {
+	word pc;
+	byte a, x, y, s, p;
+	int ram_count;
+	word ram_addr[SST_MAX_CYCLES * 2];
+	byte ram_value[SST_MAX_CYCLES * 2];
+} Fuzz_case;
+
+typedef struct fuzz_worker {
+	Sst* sst;
+	byte* base;
+	Ref_cpu ref;
+	uint64_t rng;
+	int opcode;
+	bool bus;
+	Jit* jit;
+	unsigned long cases;
+} Fuzz_worker;
+
+static bool fuzz_opcode_supported(byte opcode)
+{
+	return opcodes[opcode].n != unimplemented && opcodes[opcode].n != JAM;
+}
+
+// runs one instruction through both cpus, the sst ram must match w->base beforehand
+static void fuzz_execute(Fuzz_worker* w, Fuzz_case* c)
+{
+	Cpu_6502* cpu = w->sst->cpu;
+	System s;
+	s.s = sst_system;
+	s.h = w->sst;
+
+	memset(&w->ref, 0, sizeof(w->ref));
+	w->ref.ram = w->base;
+	w->ref.pc = c->pc;
+	w->ref.a = c->a;
+	w->ref.x = c->x;
+	w->ref.y = c->y;
+	w->ref.s = c->s;
+	w->ref.p = c->p;
+	ref_step(&w->ref);
+
+	cpu->pc = c->pc;
+	cpu->reg[reg_a] = c->a;
+	cpu->reg[reg_x] = c->x;
+	cpu->reg[reg_y] = c->y;
+	cpu->reg[reg_sp] = c->s;
+	cpu_set_p(cpu, c->p);
+	cpu->cycles = 0;
+	w->sst->cycle_count = 0;
+	// every case is new code, so each one gets translated on its own
+	if (w->jit != NULL) {
+		jit_invalidate(w->jit, c->pc, c->pc);
+		if (jit_run(w->jit, s, cpu, 1) != 0)
+			return;
+	}
+	sst_cpu_step(w->sst, cpu);
+}
+
+static bool fuzz_matches(Fuzz_worker* w)
+{
+	Cpu_6502* cpu = w->sst->cpu;
+	Sst* sst = w->sst;
+	Ref_cpu* r = &w->ref;
+	if (cpu->pc != r->pc || cpu->reg[reg_a] != r->a || cpu->reg[reg_x] != r->x
+	    || cpu->reg[reg_y] != r->y || cpu->reg[reg_sp] != r->s || cpu_get_p(cpu) != r->p)
+		return false;
+	if (SST_MAX_CYCLES < sst->cycle_count || SST_MAX_CYCLES < r->cycle_count)
+		return false;
+	if (cpu->cycles != (uint64_t)r->cycle_count)
+		return false;
+	if (w->bus) {
+		if (sst->cycle_count != r->cycle_count)
+			return false;
+		for (int i=0; i<r->cycle_count; i++) {
+			if (sst->cycles[i].addr != r->cycles[i].addr
+			    || sst->cycles[i].value != r->cycles[i].value
+			    || sst->cycles[i].write != r->cycles[i].write)
+				return false;
+		}
+		return true;
+	}
+	for (int i=0; i<sst->cycle_count; i++) {
+		if (sst->cycles[i].write && sst->ram[sst->cycles[i].addr] != ref_peek(r, sst->cycles[i].addr))
+			return false;
+	}
+	for (int i=0; i<r->cycle_count; i++) {
+		if (r->cycles[i].write && sst->ram[r->cycles[i].addr] != ref_peek(r, r->cycles[i].addr))
+			return false;
+	}
+	return true;
+}
+
+static void fuzz_add_ram(Fuzz_case* c, word addr, byte value)
+{
+	for (int i=0; i<c->ram_count; i++) {
+		if (c->ram_addr[i] == addr)
+			return;
+	}
+	if (c->ram_count < SST_MAX_CYCLES * 2) {
+		c->ram_addr[c->ram_count] = addr;
+		c->ram_value[c->ram_count] = value;
+		c->ram_count++;
+	}
+}
+
+// collects every address either cpu read before writing it, which is the
+// whole of the memory the case depends on
+static void fuzz_collect_ram(Fuzz_worker* w, Fuzz_case* c)
+{
+	Sst_cycle* logs[2] = { w->ref.cycles, w->sst->cycles };
+	int counts[2] = { w->ref.cycle_count, w->sst->cycle_count };
+	c->ram_count = 0;
+	for (int l=0; l<2; l++) {
+		if (SST_MAX_CYCLES < counts[l])
+			counts[l] = SST_MAX_CYCLES;
+		for (int i=0; i<counts[l]; i++) {
+			bool written = false;
+			for (int j=0; j<i; j++) {
+				if (logs[l][j].write && logs[l][j].addr == logs[l][i].addr)
+					written = true;
+			}
+			if (!logs[l][i].write && !written)
+				fuzz_add_ram(c, logs[l][i].addr, w->base[logs[l][i].addr]);
+		}
+	}
+}
+
+static void fuzz_print_cycles(FILE* f, Sst_cycle* cycles, int count)
+{
+	if (SST_MAX_CYCLES < count)
+		count = SST_MAX_CYCLES;
+	for (int i=0; i<count; i++)
+		fprintf(f, "%s[%d, %d, \"%s\"]", i ? ", " : "", cycles[i].addr, cycles[i].value, cycles[i].write ? "write" : "read");
+}
+
+// prints the failing case in the single step test format, with the reference
+// model as the expected result, so it can be fed back into run_sst
+static void fuzz_report(Fuzz_worker* w, Fuzz_case* c)
+{
+	Ref_cpu* r = &w->ref;
+	Cpu_6502* cpu = w->sst->cpu;
+	FILE* f = stdout;
+	fprintf(f, "[{\"name\": \"fuzz %02x %02x %02x\",\n", w->base[c->pc], w->base[(word)(c->pc + 1)], w->base[(word)(c->pc + 2)]);
+	fprintf(f, " \"initial\": {\"pc\": %d, \"s\": %d, \"a\": %d, \"x\": %d, \"y\": %d, \"p\": %d, \"ram\": [",
+		c->pc, c->s, c->a, c->x, c->y, c->p);
+	for (int i=0; i<c->ram_count; i++)
+		fprintf(f, "%s[%d, %d]", i ? ", " : "", c->ram_addr[i], c->ram_value[i]);
+	fprintf(f, "]},\n \"final\": {\"pc\": %d, \"s\": %d, \"a\": %d, \"x\": %d, \"y\": %d, \"p\": %d, \"ram\": [",
+		r->pc, r->s, r->a, r->x, r->y, r->p);
+	int printed = 0;
+	for (int i=0; i<c->ram_count; i++) {
+		fprintf(f, "%s[%d, %d]", printed++ ? ", " : "", c->ram_addr[i], ref_peek(r, c->ram_addr[i]));
+	}
+	for (int i=0; i<r->cycle_count && i<SST_MAX_CYCLES; i++) {
+		bool listed = false;
+		for (int j=0; j<c->ram_count; j++)
+			listed |= c->ram_addr[j] == r->cycles[i].addr;
+		for (int j=0; j<i; j++)
+			listed |= r->cycles[j].write && r->cycles[j].addr == r->cycles[i].addr;
+		if (r->cycles[i].write && !listed)
+			fprintf(f, "%s[%d, %d]", printed++ ? ", " : "", r->cycles[i].addr, ref_peek(r, r->cycles[i].addr));
+	}
+	fprintf(f, "]},\n \"cycles\": [");
+	fuzz_print_cycles(f, r->cycles, r->cycle_count);
+	fprintf(f, "]}]\n");
+	fprintf(f, "core: pc:%04X a:%02X x:%02X y:%02X s:%02X p:%02X cycles: [",
+		cpu->pc, cpu->reg[reg_a], cpu->reg[reg_x], cpu->reg[reg_y], cpu->reg[reg_sp], cpu_get_p(cpu));
+	fuzz_print_cycles(f, w->sst->cycles, w->sst->cycle_count);
+	fprintf(f, "]\n");
+}
+
+static void fuzz_worker_init(Fuzz_worker* w, uint64_t seed, int opcode, bool bus, bool jit)
+{
+	memset(w, 0, sizeof(*w));
+	w->sst = (Sst*)calloc(1, sizeof(Sst));
+	w->sst->cpu = (Cpu_6502*)calloc(1, sizeof(Cpu_6502));
+	w->base = (byte*)malloc(0x10000);
+	w->rng = seed * 0x9E3779B97F4A7C15ULL + 1;
+	w->opcode = opcode;
+	w->bus = bus;
+	if (jit && (w->jit = jit_create()) != NULL) {
+		jit_set_code_pages(w->jit, 0, 0xFF, true);
+		jit_set_hot_threshold(w->jit, 0);
+		jit_set_block_limit(w->jit, 1);
+	}
+}
+
+#ifdef NEMU_LIBFUZZER
+
+static Fuzz_worker libfuzzer_worker;
+
+// input layout: opcode, two operand bytes, pc, a, x, y, s, p, then memory contents
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	Fuzz_worker* w = &libfuzzer_worker;
+	Fuzz_case c;
+	if (size < 10 || !fuzz_opcode_supported(data[0]))
+		return 0;
+	if (w->sst == NULL)
+		fuzz_worker_init(w, 1, -1, getenv("NEMU_FUZZ_WRITES") == NULL, false);
+	for (int i=0; i<0x10000; i++)
+		w->base[i] = size == 10 ? 0 : data[10 + i % (size - 10)];
+	memset(&c, 0, sizeof(c));
+	c.pc = data[3] | (data[4] << 8);
+	c.a = data[5];
+	c.x = data[6];
+	c.y = data[7];
+	c.s = data[8];
+	c.p = (data[9] | 0x20) & ~0x10;
+	for (int i=0; i<3; i++)
+		w->base[(word)(c.pc + i)] = data[i];
+	memcpy(w->sst->ram, w->base, sizeof(w->sst->ram));
+	fuzz_execute(w, &c);
+	if (!fuzz_matches(w)) {
+		fuzz_collect_ram(w, &c);
+		fuzz_report(w, &c);
+		abort();
+	}
+	return 0;
+}
+
+#else
+
+static uint64_t fuzz_rand(Fuzz_worker* w)
+{
+	w->rng ^= w->rng << 13;
+	w->rng ^= w->rng >> 7;
+	w->rng ^= w->rng << 17;
+	return w->rng;
+}
+
+static void fuzz_restore(Fuzz_worker* w)
+{
+	Sst* sst = w->sst;
+	if (SST_MAX_CYCLES < sst->cycle_count) {
+		memcpy(sst->ram, w->base, sizeof(sst->ram));
+		return;
+	}
+	for (int i=0; i<sst->cycle_count; i++) {
+		if (sst->cycles[i].write)
+			sst->ram[sst->cycles[i].addr] = w->base[sst->cycles[i].addr];
+	}
+}
+
+// replays a case on otherwise zeroed memory, returns true if it still fails
+static bool fuzz_replay(Fuzz_worker* w, Fuzz_case* c)
+{
+	memset(w->base, 0, 0x10000);
+	for (int i=0; i<c->ram_count; i++)
+		w->base[c->ram_addr[i]] = c->ram_value[i];
+	memcpy(w->sst->ram, w->base, sizeof(w->sst->ram));
+	fuzz_execute(w, c);
+	bool failed = !fuzz_matches(w);
+	fuzz_collect_ram(w, c);
+	return failed;
+}
+
+static bool fuzz_try(Fuzz_worker* w, Fuzz_case* c, Fuzz_case* attempt)
+{
+	if (!fuzz_replay(w, attempt))
+		return false;
+	*c = *attempt;
+	return true;
+}
+
+static void fuzz_minimize(Fuzz_worker* w, Fuzz_case* c)
+{
+	Fuzz_case attempt;
+	bool improved = true;
+	fuzz_replay(w, c);
+	while (improved) {
+		improved = false;
+		byte* regs[] = { &attempt.a, &attempt.x, &attempt.y, &attempt.s };
+		for (int i=0; i<4; i++) {
+			attempt = *c;
+			if (*regs[i] != 0) {
+				*regs[i] = 0;
+				improved |= fuzz_try(w, c, &attempt);
+			}
+		}
+		attempt = *c;
+		if ((attempt.p & ~0x20) != 0) {
+			attempt.p = 0x20;
+			improved |= fuzz_try(w, c, &attempt);
+		}
+		for (int i=0; i<c->ram_count; i++) {
+			attempt = *c;
+			if (attempt.ram_addr[i] != attempt.pc && attempt.ram_value[i] != 0) {
+				attempt.ram_value[i] = 0;
+				improved |= fuzz_try(w, c, &attempt);
+			}
+		}
+	}
+	fuzz_replay(w, c);
+}
+
+static void fuzz_worker_destroy(Fuzz_worker* w)
+{
+	free(w->base);
+	free(w->sst->cpu);
+	free(w->sst);
+	jit_destroy(w->jit);
+}
+
+static void fuzz_fill(Fuzz_worker* w)
+{
+	for (int i=0; i<0x10000; i+=8) {
+		uint64_t r = fuzz_rand(w);
+		memcpy(w->base + i, &r, 8);
+	}
+	memcpy(w->sst->ram, w->base, sizeof(w->sst->ram));
+}
+
+// returns false and leaves the failing case in c when the cpus disagree
+static bool fuzz_one(Fuzz_worker* w, Fuzz_case* c)
+{
+	uint64_t r = fuzz_rand(w);
+	byte opcode;
+	do {
+		opcode = w->opcode < 0 ? (byte)fuzz_rand(w) : w->opcode;
+	} while (!fuzz_opcode_supported(opcode));
+	c->pc = r;
+	c->a = r >> 16;
+	c->x = r >> 24;
+	c->y = r >> 32;
+	c->s = r >> 40;
+	c->p = ((r >> 48) | 0x20) & ~0x10;
+	c->ram_count = 0;
+	w->base[c->pc] = opcode;
+	w->sst->ram[c->pc] = opcode;
+	fuzz_execute(w, c);
+	bool ok = fuzz_matches(w);
+	fuzz_restore(w);
+	w->cases++;
+	if (!ok)
+		fuzz_collect_ram(w, c);
+	return ok;
+}
+
+typedef struct fuzz_options {
+	int threads;
+	unsigned long cases;
+	int seconds;
+	int opcode;
+	uint64_t seed;
+	bool bus;
+	bool jit;
+} Fuzz_options;
+
+static Fuzz_options options;
+static atomic_ulong cases_run;
+static atomic_bool stop;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static int failures;
+
+static void* fuzz_thread(void* arg)
+{
+	Fuzz_worker w;
+	Fuzz_case c;
+	fuzz_worker_init(&w, options.seed + (uintptr_t)arg, options.opcode, options.bus, options.jit);
+	while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+		fuzz_fill(&w);
+		for (int i=0; i<4096; i++) {
+			if (!fuzz_one(&w, &c)) {
+				fuzz_minimize(&w, &c);
+				pthread_mutex_lock(&report_lock);
+				if (!atomic_exchange(&stop, true)) {
+					failures++;
+					fuzz_report(&w, &c);
+				}
+				pthread_mutex_unlock(&report_lock);
+				break;
+			}
+		}
+		unsigned long total = atomic_fetch_add(&cases_run, w.cases) + w.cases;
+		w.cases = 0;
+		if (options.cases && options.cases <= total)
+			atomic_store(&stop, true);
+	}
+	fuzz_worker_destroy(&w);
+	return NULL;
+}
+
+static void usage(char* name)
+{
+	printf("usage: %s [-j threads] [-n cases] [-t seconds] [-o opcode] [-s seed] [-w] [-J]\n", name);
+	printf("  -w  only compare registers and written memory instead of every bus cycle\n");
+	printf("  -J  run the cases through the jit, implies -w as it skips rom fetches\n");
+}
+
+int main(int argc, char* argv[])
+{
+	int opt;
+	options.threads = sysconf(_SC_NPROCESSORS_ONLN);
+	options.cases = 0;
+	options.seconds = 10;
+	options.opcode = -1;
+	options.seed = time(NULL);
+	options.bus = true;
+	while ((opt = getopt(argc, argv, "j:n:t:o:s:wJh")) != -1) {
+		switch (opt) {
+		case 'j':
+			options.threads = atoi(optarg);
+			break;
+		case 'n':
+			options.cases = strtoul(optarg, NULL, 10);
+			options.seconds = 0;
+			break;
+		case 't':
+			options.seconds = atoi(optarg);
+			break;
+		case 'o':
+			options.opcode = strtol(optarg, NULL, 16);
+			break;
+		case 's':
+			options.seed = strtoull(optarg, NULL, 10);
+			break;
+		case 'w':
+			options.bus = false;
+			break;
+		case 'J':
+			options.jit = true;
+			options.bus = false;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (options.threads < 1)
+		options.threads = 1;
+	if (0 <= options.opcode && !fuzz_opcode_supported(options.opcode)) {
+		printf("opcode %02X is not implemented\n", options.opcode);
+		return 1;
+	}
+	printf("fuzzing with %d threads, seed %llu\n", options.threads, (unsigned long long)options.seed);
+	pthread_t* threads = malloc(sizeof(pthread_t) * options.threads);
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i=0; i<options.threads; i++)
+		pthread_create(&threads[i], NULL, fuzz_thread, (void*)(uintptr_t)i);
+	while (!atomic_load(&stop)) {
+		usleep(10000);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (options.seconds && options.seconds <= now.tv_sec - start.tv_sec)
+			atomic_store(&stop, true);
+	}
+	for (int i=0; i<options.threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+	unsigned long total = atomic_load(&cases_run);
+	printf("%lu cases in %.2fs (%.0f/s), %d failures\n", total, elapsed, total / elapsed, failures);
+	return failures ? 1 : 0;
+}
+
+#endif
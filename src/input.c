@@ -0,0 +1,32 @@
+#include <stdio.h>
+#include <stdatomic.h>
+#include "types.h"
+#include "input.h"
+
+void input_init(Input_queue* q)
+{
+	atomic_store(&q->head, 0);
+	atomic_store(&q->tail, 0);
+}
+
+// returns false if the queue is full and the event was dropped
+bool input_push(Input_queue* q, Input_event e)
+{
+	uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&q->tail, memory_order_acquire) == INPUT_QUEUE)
+		return false;
+	q->events[head & (INPUT_QUEUE - 1)] = e;
+	atomic_store_explicit(&q->head, head + 1, memory_order_release);
+	return true;
+}
+
+// returns false if there's nothing queued
+bool input_pop(Input_queue* q, Input_event* e)
+{
+	uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	if (atomic_load_explicit(&q->head, memory_order_acquire) == tail)
+		return false;
+	*e = q->events[tail & (INPUT_QUEUE - 1)];
+	atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+	return true;
+}
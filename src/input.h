@@ -0,0 +1,31 @@
+// what the window's events ask the emulation thread to do. one thread pushes
+// and the other pops, each only moving its own end, so there's no lock.
+// the controller goes over as snapshots of every button, the emulation takes
+// at most one at the start of each frame, so each change is seen for a frame.
+
+#define INPUT_QUEUE 256 // events, a power of two
+
+enum input_kind {
+	input_buttons,
+	input_pause,
+	input_step,
+	input_reset,
+	input_power,
+	input_quit,
+};
+
+typedef struct input_event {
+	byte kind;
+	byte buttons; // for input_buttons, a bit for each of famicom_joypad_buttons that's held
+	uint64_t time; // of the event behind it, in sdl's ticks in ns
+} Input_event;
+
+typedef struct input_queue {
+	Input_event events[INPUT_QUEUE];
+	_Atomic uint32_t head;
+	_Atomic uint32_t tail;
+} Input_queue;
+
+void input_init(Input_queue* q);
+bool input_push(Input_queue* q, Input_event e);
+bool input_pop(Input_queue* q, Input_event* e);
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "systems/system.h"
+#include "chips/2C02.h"
+#include "chips/2A03.h"
+#include "chips/6502.h"
+#include "systems/famicom.h"
+
+// runs a rom on two famicoms, one interpreted and one with the jit and idle loop
+// skipping, and compares them every few instructions. there's no ppu here, vblank is set on both at the
+// same instruction every frame's worth of cycles instead, and the mapper irq is
+// held for the second half of each frame.
+
+#define LOCKSTEP_CHUNK 64 // instructions between comparisons
+#define LOCKSTEP_FRAME 29781 // cpu cycles
+
+Famicom* lockstep_load(char* filename)
+{
+	FILE* rom = fopen(filename, "rb");
+	if (rom == NULL) {
+		printf("couldn't open file\n");
+		return NULL;
+	}
+	Famicom* f = famicom_create();
+	if (f == NULL)
+		return NULL;
+	if (famicom_load_rom(f, rom) == 1) {
+		famicom_destroy(f);
+		return NULL;
+	}
+	f->loaded_rom.name = filename;
+	famicom_reset(f, false);
+	return f;
+}
+
+bool lockstep_matches(Famicom* a, Famicom* b)
+{
+	return a->cpu->pc == b->cpu->pc
+	    && memcmp(a->cpu->reg, b->cpu->reg, sizeof(a->cpu->reg)) == 0
+	    && cpu_get_p(a->cpu) == cpu_get_p(b->cpu)
+	    && a->cpu->cycles == b->cpu->cycles
+	    && a->cpu->running == b->cpu->running
+	    && a->cpu->interrupt == b->cpu->interrupt
+	    && a->cpu->nmi_pending == b->cpu->nmi_pending
+	    && a->prg_bank == b->prg_bank
+	    && memcmp(a->mem, b->mem, 0x800) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		printf("usage: %s rom.nes [instructions]\n", argv[0]);
+		return 1;
+	}
+	long instructions = argc < 3 ? 10000000 : strtol(argv[2], NULL, 10);
+	Famicom* interpreted = lockstep_load(argv[1]);
+	Famicom* jitted = lockstep_load(argv[1]);
+	if (interpreted == NULL || jitted == NULL)
+		return 1;
+	interpreted->skip_idle = false;
+	if (!famicom_enable_jit(jitted)) {
+		printf("the jit isn't available on this platform\n");
+		return 1;
+	}
+	System si; si.s = famicom_system; si.h = interpreted;
+	System sj; sj.s = famicom_system; sj.h = jitted;
+	uint64_t next_frame = LOCKSTEP_FRAME;
+	bool irq = false;
+	word last_pc = interpreted->cpu->pc;
+	long done;
+	for (done = 0; done < instructions && interpreted->cpu->running; done += LOCKSTEP_CHUNK) {
+		famicom_step(interpreted, LOCKSTEP_CHUNK, false, NULL);
+		famicom_step(jitted, LOCKSTEP_CHUNK, false, NULL);
+		if (!lockstep_matches(interpreted, jitted)) {
+			printf("mismatch after %ld instructions, in the %d from %04X\n", done, LOCKSTEP_CHUNK, last_pc);
+			printf("interpreter: ");
+			write_cpu_state(interpreted->cpu, si, stdout);
+			printf("jit:         ");
+			write_cpu_state(jitted->cpu, sj, stdout);
+			for (int i=0; i<0x800; i++) {
+				if (interpreted->mem[i] != jitted->mem[i])
+					printf("ram %04X: %02X %02X\n", i, interpreted->mem[i], jitted->mem[i]);
+			}
+			return 1;
+		}
+		if (next_frame <= interpreted->cpu->cycles) {
+			next_frame += LOCKSTEP_FRAME;
+			famicom_set_vblank(interpreted, true);
+			famicom_set_vblank(jitted, true);
+		}
+		if (irq != (next_frame - LOCKSTEP_FRAME / 2 <= interpreted->cpu->cycles)) {
+			irq = !irq;
+			cpu_set_irq(interpreted->cpu, famicom_irq_mapper, irq);
+			cpu_set_irq(jitted->cpu, famicom_irq_mapper, irq);
+		}
+		last_pc = interpreted->cpu->pc;
+	}
+	printf("%ld instructions, %llu cycles, no mismatches\n", done, (unsigned long long)interpreted->cpu->cycles);
+	famicom_destroy(interpreted);
+	famicom_destroy(jitted);
+	return 0;
+}
@@ -4,6 +4,8 @@
 #include <string.h>
 #include <stdbool.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 #include "SDL_keycode.h"
@@ -12,12 +14,20 @@
 #include "systems/system.h"
 
 #include "chips/2C02.h"
+#include "chips/2C02_kernels.h"
+#include "chips/2A03.h"
 #include "chips/6502.h"
+#include "systems/rom.h"
 #include "systems/famicom.h"
 #include "systems/apple1.h"
 
+#include "palette.h"
 #include "graphics.h"
 #include "audio.h"
+#include "capture.h"
+#include "frames.h"
+#include "input.h"
+#include "save.h"
 
 #define VERSION "0.0.0"
 
@@ -26,10 +36,29 @@ Famicom* famicom; // todo: shove these pointers inside selected_system
 Apple1* apple1;
 
 SDL_Instance* graphics;
-SDL_Color palette[4];
 bool debug_file;
 FILE* rom;
 FILE* dfh;
+int headless_frames; // run this many frames without sdl, if it's not 0
+Capture* capture;
+bool audio_hash;
+// the famicom runs on its own thread while there's a window
+SDL_Thread* emulation;
+_Atomic bool emulating;
+Frames frames;
+Input_queue input;
+Save* save; // the cart's battery backed ram, if it has any
+// set by handle_signal(), the loops stop when they see it and main cleans up
+volatile sig_atomic_t quit_signal;
+// the controller as the window's events leave it, only touched by the main thread
+byte buttons_held;
+byte buttons_tapped; // pressed since the last snapshot, even if let go again
+byte buttons_sent;
+uint64_t buttons_time;
+// from an input's event to presenting the first frame that saw it
+int latency_count;
+uint64_t latency_total;
+uint64_t latency_max;
 
 void usage(char* name);
 void destroy_system();
@@ -37,6 +66,7 @@ void handle_signal(int sig);
 void nemu_exit();
 void draw_graphics();
 void famicom_loop();
+void famicom_headless();
 void apple1_loop();
 
 int main(int argc, char* argv[])
@@ -45,13 +75,14 @@ int main(int argc, char* argv[])
 
 	signal(SIGINT, handle_signal);
 
-	if (selected_system.s == famicom_system && argc == 1) {
-		usage(argv[0]);
-		return 0;
-	}
-
-	if (2 < argc) {
-		if (strcmp("-debug", argv[1]) == 0) {
+	char* palette_file = NULL;
+	enum palette_region region = palette_ntsc;
+	bool cache_background = false;
+	bool jit = false;
+	char* wav_file = NULL;
+	int arg;
+	for (arg=1; arg<argc && argv[arg][0] == '-'; arg++) {
+		if (strcmp("-debug", argv[arg]) == 0) {
 			printf("logging to file\n");
 			debug_file = true;
 			dfh = fopen("debug.log", "w");
@@ -59,34 +90,91 @@ int main(int argc, char* argv[])
 				printf("couldn't open debug log\n");
 				return 1;
 			}
+		} else if (strcmp("-palette", argv[arg]) == 0 && arg + 1 < argc) {
+			palette_file = argv[++arg];
+		} else if (strcmp("-pal", argv[arg]) == 0) {
+			region = palette_pal;
+		} else if (strcmp("-cache", argv[arg]) == 0) {
+			cache_background = true;
+		} else if (strcmp("-jit", argv[arg]) == 0) {
+			jit = true;
+		} else if (strcmp("-headless", argv[arg]) == 0 && arg + 1 < argc && 0 < atoi(argv[arg + 1])) {
+			headless_frames = atoi(argv[++arg]);
+		} else if (strcmp("-wav", argv[arg]) == 0 && arg + 1 < argc) {
+			wav_file = argv[++arg];
+		} else if (strcmp("-hash", argv[arg]) == 0) {
+			audio_hash = true;
+		} else {
+			usage(argv[0]);
+			return 1;
 		}
 	}
+
+	if (selected_system.s == famicom_system && arg == argc) {
+		usage(argv[0]);
+		return 0;
+	}
+	if ((wav_file != NULL || audio_hash) && headless_frames == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	// before anything's printed, in case the samples go to stdout
+	if (wav_file != NULL) {
+		capture = capture_open(wav_file, APU_SAMPLE_RATE);
+		if (capture == NULL)
+			return 1;
+	}
+
 	char windowname[255];
 	switch (selected_system.s) {
 	case famicom_system:
-		char* filename;
-		if (debug_file) {
-			filename = argv[2];
-		} else {
-			filename = argv[1];
-		}
+		char* filename = argv[arg];
 		rom = fopen(filename, "rb");
 		if (rom == NULL) {
 			printf("couldn't open file\n");
+			nemu_exit();
 			return 1;
 		}
 		famicom = famicom_create();
 		if (famicom == NULL) {
+			nemu_exit();
 			return 1;
 		}
 		if (famicom_load_rom(famicom, rom) == 1) {
-			free(famicom);
+			famicom_destroy(famicom);
+			famicom = NULL;
+			nemu_exit();
 			return 1;
 		}
 		snprintf(windowname, sizeof(windowname), "nemu | %s", filename);
 		selected_system.h = famicom;
-		famicom->loaded_rom.name = argv[1];
+		famicom->loaded_rom.name = filename;
 		famicom_reset(famicom, false);
+		if (cache_background && !ppu_cache_background(famicom->ppu, true)) {
+			nemu_exit();
+			return 1;
+		}
+		if (jit && !famicom_enable_jit(famicom)) {
+			printf("the jit isn't available here\n");
+			nemu_exit();
+			return 1;
+		}
+		if (headless_frames != 0) {
+			famicom_headless();
+			nemu_exit();
+			return quit_signal;
+		}
+		// headless runs leave saves alone, so they start the same every time
+		if (famicom->rom->battery && famicom->prg_ram != NULL) {
+			char* save_file = save_filename(filename);
+			if (save_file != NULL)
+				save = save_open(save_file, famicom->prg_ram, famicom->prg_ram_size);
+			free(save_file);
+			if (save == NULL) {
+				nemu_exit();
+				return 1;
+			}
+		}
 		break;
 	case apple1_system:
 		apple1 = apple1_create();
@@ -101,6 +189,11 @@ int main(int argc, char* argv[])
 		return 1;
 	}
 	SDL_SetWindowTitle(graphics->window, windowname);
+	palette_default(&graphics->palette, region);
+	if (palette_file != NULL && palette_load(&graphics->palette, palette_file, region) == 1) {
+		nemu_exit();
+		return 1;
+	}
 	switch(selected_system.s) {
 	case famicom_system:
 		famicom_loop();
@@ -114,13 +207,13 @@ int main(int argc, char* argv[])
 	SDL_RenderPresent(graphics->renderer);
 	printf("stopping\n");
 	nemu_exit();
-	return 0;
+	return quit_signal;
 }
 
 void usage (char* name)
 {
 	printf("%s %s\n", name, VERSION);
-	printf("usage: %s [-debug] [file]\n", name);
+	printf("usage: %s [-debug] [-palette file.pal] [-pal] [-cache] [-jit] [-headless frames [-wav file.wav|-] [-hash]] [file]\n", name);
 	return;
 }
 
@@ -128,7 +221,8 @@ void destroy_system()
 {
 	switch(selected_system.s) {
 	case famicom_system:
-		famicom_destroy(famicom);
+		if (famicom != NULL)
+			famicom_destroy(famicom);
 		break;
 	case apple1_system:
 		apple1_destroy(apple1);
@@ -138,17 +232,28 @@ void destroy_system()
 
 void nemu_exit()
 {
-	graphics_destroy(graphics);
+	if (emulation != NULL) {
+		atomic_store(&emulating, false);
+		SDL_WaitThread(emulation, NULL);
+		emulation = NULL;
+	}
+	if (save != NULL) {
+		save_close(save, famicom->prg_ram);
+		save = NULL;
+	}
+	if (graphics != NULL)
+		graphics_destroy(graphics);
 	destroy_system();
+	if (capture != NULL)
+		capture_close(capture);
 	if (debug_file)
 		fclose(dfh);
 }
 
+// only sets the flag, nothing else it could do is safe in a handler
 void handle_signal(int sig)
 {
-	printf("caught signal, exiting\n");
-	nemu_exit();
-	exit(sig);
+	quit_signal = sig;
 }
 
 void draw_graphics ()
@@ -157,13 +262,8 @@ void draw_graphics ()
 	SDL_RenderClear(graphics->renderer);
 	switch (selected_system.s) {
 	case famicom_system:
-		//famicom->ppu->vblank_flag = true;
-		if (famicom->chr_size != 0) {
-
-
-			draw_oam(graphics, famicom);
-
-		}
+		draw_screen(graphics, frames.screens[frames.front], ppu_kernels_best());
+		SDL_RenderTexture(graphics->renderer, graphics->ppu_texture, NULL, NULL);
 		break;
 	case apple1_system:
 		break;
@@ -175,7 +275,7 @@ void apple1_loop()
 {
 	bool pause = false;
 	SDL_Event e;
-	while (apple1->cpu->running) {
+	while (apple1->cpu->running && !quit_signal) {
 		while (SDL_PollEvent(&e) != 0 ) {
 			switch (e.type) {
 			case SDL_EVENT_QUIT:
@@ -214,111 +314,225 @@ void apple1_loop()
 	}
 }
 
-const int famicom_cycles = 29780;
-bool pause = false;
-SDL_Event e;
-int loops = 0;
-void famicom_loop()
+#define FAMICOM_FRAME_NS 16639267 // the ntsc famicom makes 60.0988 frames a second
+#define FAMICOM_FRAMES_BEHIND 4 // further behind than this and we stop trying to catch up
+
+// the joypad button a key is mapped to, -1 if none
+int famicom_key_button(SDL_Keycode key)
 {
-	while (famicom->cpu->running) {
-		if ( SDL_PollEvent( &e ) != 0 ) {
-			switch(e.type) {
-			case SDL_EVENT_QUIT:
-				famicom->cpu->running = false;
+	switch (key) {
+	case SDLK_RETURN:
+		return joypad_start;
+	case SDLK_RSHIFT:
+		return joypad_select;
+	case SDLK_Z:
+		return joypad_b;
+	case SDLK_X:
+		return joypad_a;
+	case SDLK_UP:
+		return joypad_up;
+	case SDLK_DOWN:
+		return joypad_down;
+	case SDLK_LEFT:
+		return joypad_left;
+	case SDLK_RIGHT:
+		return joypad_right;
+	}
+	return -1;
+}
+
+// turns a window event into what the emulation thread should do. buttons
+// only change the held state, famicom_send_buttons() passes it on.
+void famicom_event(SDL_Event* e)
+{
+	Input_event in;
+	in.kind = input_buttons;
+	in.buttons = 0;
+	in.time = e->common.timestamp;
+	bool pressed = e->type == SDL_EVENT_KEY_DOWN;
+	switch (e->type) {
+	case SDL_EVENT_QUIT:
+		in.kind = input_quit;
+		break;
+	case SDL_EVENT_KEY_DOWN:
+	case SDL_EVENT_KEY_UP:
+		if (e->key.repeat)
+			return;
+		switch (e->key.key) {
+		case SDLK_ESCAPE:
+			in.kind = input_quit;
+			break;
+		case SDLK_F3:
+			in.kind = input_pause;
+			break;
+		case SDLK_F4:
+			in.kind = input_step;
+			break;
+		case SDLK_F1:
+			in.kind = input_reset;
+			break;
+		case SDLK_F2:
+			in.kind = input_power;
+			break;
+		default:
+			if (famicom_key_button(e->key.key) < 0)
+				return;
+			byte bit = 1 << famicom_key_button(e->key.key);
+			if (pressed) {
+				buttons_held |= bit;
+				buttons_tapped |= bit;
+			} else {
+				buttons_held &= ~bit;
+			}
+			buttons_time = e->common.timestamp;
+			return;
+		}
+		if (!pressed)
+			return;
+		break;
+	default:
+		return;
+	}
+	input_push(&input, in);
+}
+
+// queues a snapshot of the controller if it's changed. a button pressed and
+// let go since the last one still shows as held in this one.
+void famicom_send_buttons()
+{
+	byte buttons = buttons_held | buttons_tapped;
+	buttons_tapped = 0;
+	if (buttons == buttons_sent)
+		return;
+	Input_event in;
+	in.kind = input_buttons;
+	in.buttons = buttons;
+	in.time = buttons_time;
+	if (input_push(&input, in))
+		buttons_sent = buttons;
+}
+
+// copies the ppu's screen out as the newest frame
+void famicom_publish_frame()
+{
+	memcpy(frames.screens[frames.back], famicom->ppu->screen, sizeof(famicom->ppu->screen));
+	frames_publish(&frames);
+	frames.input_time[frames.back] = 0;
+}
+
+// the emulation thread. it carries out what's been queued, runs a frame, and
+// hands it and its audio on. then it sleeps until the frame's time is up,
+// against deadlines that don't drift with how long each frame took to run.
+int famicom_thread(void* data)
+{
+	bool pause = false;
+	Uint64 deadline = SDL_GetTicksNS();
+	while (atomic_load(&emulating) && famicom->cpu->running) {
+		// the controller only changes between frames, and once a frame
+		Input_event in;
+		bool buttons_taken = false;
+		while (!buttons_taken && input_pop(&input, &in)) {
+			switch (in.kind) {
+			case input_buttons:
+				famicom_set_buttons(&famicom->controller_p1, in.buttons);
+				frames.input_time[frames.back] = in.time;
+				buttons_taken = true;
 				break;
-			case SDL_EVENT_KEY_DOWN:
-				switch (e.key.key) {
-				case SDLK_ESCAPE:
-					famicom->cpu->running = false;
-					break;
-				case SDLK_F3:
-					pause = !pause;
-					break;
-				case SDLK_F4:
-					famicom_step(famicom, 1, false, NULL);
-					draw_graphics();
-					break;
-				case SDLK_F1:
-					famicom_reset(famicom, true);
-					famicom_step(famicom, 1, false, NULL);
-					draw_graphics();
-				case SDLK_F2:
-					famicom_reset(famicom, false);
-					famicom_step(famicom, 1, false, NULL);
-					draw_graphics();
-					break;
-				case SDLK_RETURN:
-					famicom->controller_p1.start = true;
-					break;
-				case SDLK_RSHIFT:
-					famicom->controller_p1.select = true;
-					break;
-				case SDLK_Z:
-					famicom->controller_p1.button_b = true;
-					break;
-				case SDLK_X:
-					famicom->controller_p1.button_a = true;
-					break;
-				case SDLK_UP:
-					famicom->controller_p1.up = true;
-					break;
-				case SDLK_DOWN:
-					famicom->controller_p1.down = true;
-					break;
-				case SDLK_LEFT:
-					famicom->controller_p1.left = true;
-					break;
-				case SDLK_RIGHT:
-					famicom->controller_p1.right = true;
-					break;
-				}
+			case input_pause:
+				pause = !pause;
 				break;
-			case SDL_EVENT_KEY_UP:
-				switch (e.key.key) {
-				case SDLK_RETURN:
-					famicom->controller_p1.start = false;
-					break;
-				case SDLK_Z:
-					famicom->controller_p1.button_b = false;
-					break;
-				case SDLK_X:
-					famicom->controller_p1.button_a = false;
-					break;
-				case SDLK_UP:
-					famicom->controller_p1.up = false;
-					break;
-				case SDLK_DOWN:
-					famicom->controller_p1.down = false;
-					break;
-				case SDLK_LEFT:
-					famicom->controller_p1.left = false;
-					break;
-				case SDLK_RIGHT:
-					famicom->controller_p1.right = false;
-					break;
-				}
+			case input_step:
+				famicom_step(famicom, 1, false, NULL);
+				famicom_publish_frame();
+				break;
+			case input_reset:
+			case input_power:
+				famicom_reset(famicom, in.kind == input_reset);
+				famicom_step(famicom, 1, false, NULL);
+				famicom_publish_frame();
+				break;
+			case input_quit:
+				famicom->cpu->running = false;
 				break;
 			}
 		}
-		if (!pause) {
-			SDL_SetRenderTarget(graphics->renderer, graphics->ppu_texture);
-			for (int c=0; c<famicom_cycles; c++) {
-			tick_ppu(graphics, famicom);
-			tick_ppu(graphics, famicom);
-			tick_ppu(graphics, famicom);
-			famicom_step(famicom, 1, debug_file, dfh);
+		if (pause || !famicom->cpu->running) {
+			SDL_DelayNS(FAMICOM_FRAME_NS / 4);
+			deadline = SDL_GetTicksNS();
+			continue;
+		}
+		famicom_run_frame(famicom, debug_file, dfh);
+		famicom_publish_frame();
+		// if the writer's busy with the last copy, the next frame hands it over
+		if (save != NULL && famicom->prg_ram_dirty && save_update(save, famicom->prg_ram))
+			famicom->prg_ram_dirty = false;
+		apu_process(graphics, famicom);
+		deadline += FAMICOM_FRAME_NS;
+		Uint64 now = SDL_GetTicksNS();
+		if (now < deadline)
+			SDL_DelayPrecise(deadline - now);
+		else if (FAMICOM_FRAMES_BEHIND * FAMICOM_FRAME_NS < now - deadline)
+			deadline = now;
+	}
+	atomic_store(&emulating, false);
+	return 0;
+}
+
+// the main thread only handles the window's events and presents the newest
+// frame, so a slow present doesn't hold up the emulation or the other way round
+void famicom_loop()
+{
+	frames_init(&frames);
+	input_init(&input);
+	atomic_store(&emulating, true);
+	emulation = SDL_CreateThread(famicom_thread, "famicom", NULL);
+	if (emulation == NULL) {
+		printf("couldn't start the emulation thread: %s\n", SDL_GetError());
+		return;
+	}
+	SDL_Event e;
+	while (atomic_load(&emulating) && !quit_signal) {
+		// everything that's come in, not just one event a pass
+		if (SDL_WaitEventTimeout(&e, 1)) {
+			famicom_event(&e);
+			while (SDL_PollEvent(&e))
+				famicom_event(&e);
+		}
+		famicom_send_buttons();
+		if (frames_take(&frames)) {
+			draw_graphics();
+			if (frames.input_time[frames.front] != 0) {
+				uint64_t latency = SDL_GetTicksNS() - frames.input_time[frames.front];
+				latency_count++;
+				latency_total += latency;
+				if (latency_max < latency)
+					latency_max = latency;
 			}
-			draw_oam(graphics, famicom);
-			SDL_SetRenderTarget(graphics->renderer, NULL);
-			SDL_FRect size;
-			size.x = 0;
-			size.y = 0;
-			size.w = 275;
-			size.h = 240;
-			SDL_RenderTexture(graphics->renderer, graphics->ppu_texture, NULL, &size);
-			SDL_RenderPresent(graphics->renderer);
-			//apu_process(graphics, famicom);
 		}
-		loops++;
 	}
+	atomic_store(&emulating, false);
+	SDL_WaitThread(emulation, NULL);
+	emulation = NULL;
+	if (latency_count != 0)
+		printf("input to present: %d changes, %.1f ms on average, %.1f ms at most\n", latency_count, latency_total / 1e6 / latency_count, latency_max / 1e6);
+}
+
+// runs headless_frames frames without sdl, the audio going to the capture
+// and, with -hash, each frame's hash of it printed, then the whole run's
+void famicom_headless()
+{
+	int16_t samples[APU_BUFFER];
+	uint64_t run = CAPTURE_HASH_START;
+	for (int i=0; i<headless_frames && famicom->cpu->running && !quit_signal; i++) {
+		famicom_run_frame(famicom, false, NULL);
+		int n = apu_take_samples(famicom->apu, samples, APU_BUFFER);
+		if (capture != NULL)
+			capture_write(capture, samples, n);
+		if (audio_hash) {
+			run = capture_hash(run, samples, n);
+			printf("frame %d: %d samples, %016llx\n", i, n, (unsigned long long)capture_hash(CAPTURE_HASH_START, samples, n));
+		}
+	}
+	if (audio_hash)
+		printf("audio: %016llx\n", (unsigned long long)run);
 }
@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "types.h"
+#include "systems/system.h"
+#include "chips/2C02.h"
+#include "chips/2A03.h"
+#include "chips/6502.h"
+#include "systems/rom.h"
+#include "systems/famicom.h"
+#include "palette.h"
+#include "capture.h"
+
+// runs many famicoms headless on a pool of threads, each with its own rom,
+// input and number of frames, and writes what each ended up with to a report.
+// every instance is its own Famicom. they share the tables the apu and ppu
+// build once, and a rom cache, so a rom run by many is only loaded once.
+//
+// each line of the job file is
+//	rom.nes frames [movie=file] [screenshot=file.ppm] [wav=file.wav]
+// and a movie has a line for each frame the controller changes on,
+//	frame buttons
+// where buttons is BATCH_BUTTONS with a . for each one that isn't held.
+
+#define BATCH_LINE 1024
+#define BATCH_BUTTONS "ABsSUDLR" // in the order of famicom_joypad_buttons
+
+typedef struct batch_input {
+	int frame;
+	byte buttons;
+} Batch_input;
+
+typedef struct batch_job {
+	char* rom;
+	int frames;
+	char* movie;
+	char* screenshot;
+	char* wav;
+	// what came of it
+	char* status;
+	int frames_run;
+	uint64_t cycles;
+	uint64_t screen_hash;
+	uint64_t audio_hash;
+	double seconds;
+} Batch_job;
+
+typedef struct batch {
+	Batch_job* jobs;
+	int count;
+	Rom_cache roms;
+	bool jit; // translate hot code, see famicom_enable_jit()
+	_Atomic int next; // the next job a worker takes
+} Batch;
+
+double batch_seconds(struct timespec* start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// returns the number of changes read into inputs, -1 if the movie's bad
+int batch_load_movie(char* filename, Batch_input** inputs)
+{
+	FILE* f = fopen(filename, "r");
+	if (f == NULL)
+		return -1;
+	char line[BATCH_LINE];
+	int count = 0, size = 0;
+	*inputs = NULL;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		int frame;
+		char buttons[9];
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%d %8s", &frame, buttons) != 2 || strlen(buttons) != 8) {
+			fclose(f);
+			free(*inputs);
+			return -1;
+		}
+		if (count == size) {
+			size = size ? size * 2 : 64;
+			Batch_input* grown = realloc(*inputs, size * sizeof(Batch_input));
+			if (grown == NULL) {
+				fclose(f);
+				free(*inputs);
+				return -1;
+			}
+			*inputs = grown;
+		}
+		(*inputs)[count].frame = frame;
+		(*inputs)[count].buttons = 0;
+		for (int i=0; i<8; i++) {
+			if (buttons[i] == BATCH_BUTTONS[i])
+				(*inputs)[count].buttons |= 1 << i;
+		}
+		count++;
+	}
+	fclose(f);
+	return count;
+}
+
+int batch_screenshot(char* filename, word (*screen)[PPU_WIDTH])
+{
+	FILE* f = fopen(filename, "wb");
+	if (f == NULL)
+		return 1;
+	Palette palette;
+	palette_default(&palette, palette_ntsc);
+	fprintf(f, "P6\n%d %d\n255\n", PPU_WIDTH, PPU_HEIGHT);
+	for (int y=0; y<PPU_HEIGHT; y++) {
+		byte row[PPU_WIDTH * 3];
+		for (int x=0; x<PPU_WIDTH; x++) {
+			uint32_t rgba = palette.rgba[screen[y][x]];
+			row[x * 3] = rgba >> 24;
+			row[x * 3 + 1] = rgba >> 16;
+			row[x * 3 + 2] = rgba >> 8;
+		}
+		fwrite(row, 1, sizeof(row), f);
+	}
+	fclose(f);
+	return 0;
+}
+
+void batch_run(Batch* b, Batch_job* job)
+{
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	job->status = "ok";
+	Batch_input* inputs = NULL;
+	int input_count = 0;
+	if (job->movie != NULL) {
+		input_count = batch_load_movie(job->movie, &inputs);
+		if (input_count < 0) {
+			job->status = "bad_movie";
+			return;
+		}
+	}
+	Rom_image* rom = rom_load(&b->roms, job->rom);
+	if (rom == NULL) {
+		job->status = "bad_rom";
+		free(inputs);
+		return;
+	}
+	Famicom* f = famicom_create();
+	if (f == NULL) {
+		rom_release(rom);
+		job->status = "no_memory";
+		free(inputs);
+		return;
+	}
+	if (famicom_attach_rom(f, rom) == 1) {
+		rom_release(rom);
+		famicom_destroy(f);
+		job->status = "bad_rom";
+		free(inputs);
+		return;
+	}
+	if (b->jit && !famicom_enable_jit(f)) {
+		famicom_destroy(f);
+		job->status = "no_jit";
+		free(inputs);
+		return;
+	}
+	famicom_reset(f, false);
+	Capture* wav = NULL;
+	if (job->wav != NULL && (wav = capture_open(job->wav, APU_SAMPLE_RATE)) == NULL)
+		job->status = "no_wav";
+	int16_t samples[APU_BUFFER];
+	uint64_t audio = CAPTURE_HASH_START;
+	int next_input = 0;
+	int frame;
+	for (frame=0; frame<job->frames && f->cpu->running; frame++) {
+		for (; next_input < input_count && inputs[next_input].frame <= frame; next_input++)
+			famicom_set_buttons(&f->controller_p1, inputs[next_input].buttons);
+		famicom_run_frame(f, false, NULL);
+		int n = apu_take_samples(f->apu, samples, APU_BUFFER);
+		audio = capture_hash(audio, samples, n);
+		if (wav != NULL)
+			capture_write(wav, samples, n);
+	}
+	if (!f->cpu->running)
+		job->status = "stopped";
+	job->frames_run = frame;
+	job->cycles = f->cpu->cycles;
+	job->audio_hash = audio;
+	job->screen_hash = capture_hash(CAPTURE_HASH_START, (int16_t*)f->ppu->screen, PPU_HEIGHT * PPU_WIDTH);
+	if (job->screenshot != NULL && batch_screenshot(job->screenshot, f->ppu->screen) == 1)
+		job->status = "no_screenshot";
+	if (wav != NULL)
+		capture_close(wav);
+	famicom_destroy(f);
+	free(inputs);
+	job->seconds = batch_seconds(&start);
+}
+
+void* batch_worker(void* data)
+{
+	Batch* b = data;
+	for (;;) {
+		int i = atomic_fetch_add(&b->next, 1);
+		if (b->count <= i)
+			return NULL;
+		batch_run(b, &b->jobs[i]);
+	}
+}
+
+// returns the number of jobs read, -1 if the file couldn't be
+int batch_load_jobs(char* filename, Batch_job** jobs)
+{
+	FILE* f = fopen(filename, "r");
+	if (f == NULL) {
+		printf("couldn't open %s\n", filename);
+		return -1;
+	}
+	char line[BATCH_LINE];
+	int count = 0, size = 0, number = 0;
+	*jobs = NULL;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		number++;
+		char* save;
+		char* rom = strtok_r(line, " \t\n", &save);
+		if (rom == NULL || rom[0] == '#')
+			continue;
+		char* frames = strtok_r(NULL, " \t\n", &save);
+		if (frames == NULL || atoi(frames) <= 0) {
+			printf("%s:%d: no number of frames\n", filename, number);
+			fclose(f);
+			return -1;
+		}
+		if (count == size) {
+			size = size ? size * 2 : 64;
+			Batch_job* grown = realloc(*jobs, size * sizeof(Batch_job));
+			if (grown == NULL) {
+				printf("couldn't allocate memory\n");
+				fclose(f);
+				return -1;
+			}
+			*jobs = grown;
+		}
+		Batch_job* job = &(*jobs)[count++];
+		memset(job, 0, sizeof(Batch_job));
+		job->rom = strdup(rom);
+		job->frames = atoi(frames);
+		job->status = "not_run";
+		char* option;
+		while ((option = strtok_r(NULL, " \t\n", &save)) != NULL) {
+			if (strncmp(option, "movie=", 6) == 0) {
+				job->movie = strdup(option + 6);
+			} else if (strncmp(option, "screenshot=", 11) == 0) {
+				job->screenshot = strdup(option + 11);
+			} else if (strncmp(option, "wav=", 4) == 0 && strcmp(option + 4, "-") != 0) {
+				job->wav = strdup(option + 4);
+			} else {
+				printf("%s:%d: unknown option %s\n", filename, number, option);
+				fclose(f);
+				return -1;
+			}
+		}
+	}
+	fclose(f);
+	return count;
+}
+
+void usage(char* name)
+{
+	printf("usage: %s [-j threads] [-jit] jobs.txt report.tsv\n", name);
+}
+
+int main(int argc, char* argv[])
+{
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	bool jit = false;
+	int arg;
+	for (arg=1; arg<argc && argv[arg][0] == '-'; arg++) {
+		if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+			threads = atoi(argv[++arg]);
+		} else if (strcmp(argv[arg], "-jit") == 0) {
+			jit = true;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (argc - arg != 2 || threads <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	Batch batch;
+	batch.jit = jit;
+	batch.count = batch_load_jobs(argv[arg], &batch.jobs);
+	if (batch.count < 0)
+		return 1;
+	atomic_store(&batch.next, 0);
+	rom_cache_init(&batch.roms);
+	FILE* report = fopen(argv[arg + 1], "w");
+	if (report == NULL) {
+		printf("couldn't open %s\n", argv[arg + 1]);
+		return 1;
+	}
+	if (batch.count < threads)
+		threads = batch.count;
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_t* workers = malloc(threads * sizeof(pthread_t));
+	if (workers == NULL) {
+		printf("couldn't allocate memory\n");
+		return 1;
+	}
+	for (int i=0; i<threads; i++)
+		pthread_create(&workers[i], NULL, batch_worker, &batch);
+	for (int i=0; i<threads; i++)
+		pthread_join(workers[i], NULL);
+	double seconds = batch_seconds(&start);
+
+	long frames = 0;
+	int failed = 0;
+	fprintf(report, "# rom\tframes\tcycles\tscreen\taudio\tms\tstatus\n");
+	for (int i=0; i<batch.count; i++) {
+		Batch_job* job = &batch.jobs[i];
+		fprintf(report, "%s\t%d\t%llu\t%016llx\t%016llx\t%.1f\t%s\n", job->rom, job->frames_run,
+		    (unsigned long long)job->cycles, (unsigned long long)job->screen_hash,
+		    (unsigned long long)job->audio_hash, job->seconds * 1e3, job->status);
+		frames += job->frames_run;
+		if (strcmp(job->status, "ok") != 0)
+			failed++;
+	}
+	fclose(report);
+	int roms = 0;
+	for (Rom_image* image=batch.roms.images; image!=NULL; image=image->next)
+		roms++;
+	rom_cache_destroy(&batch.roms);
+	printf("%d instances of %d roms on %d threads, %ld frames in %.2fs (%.0f fps), %d not ok\n",
+	    batch.count, roms, threads, frames, seconds, frames / seconds, failed);
+	return failed != 0;
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include "types.h"
+#include "palette.h"
+
+// taken from https://emudev.de/nes-emulator/palettes-attribute-tables-and-sprites/.
+uint32_t EMUDEV_PALETTE[PALETTE_COLOURS] = {
+		0x7C7C7C, 0x0000FC, 0x0000BC, 0x4428BC, 0x940084, 0xA80020, 0xA81000, 0x881400, 0x503000, 0x007800, 0x006800, 0x005800, 0x004058, 0x000000, 0x000000, 0x000000,
+		0xBCBCBC, 0x0078F8, 0x0058F8, 0x6844FC, 0xD800CC, 0xE40058, 0xF83800, 0xE45C10, 0xAC7C00, 0x00B800, 0x00A800, 0x00A844, 0x008888, 0x000000, 0x000000, 0x000000,
+		0xF8F8F8, 0x3CBCFC, 0x6888FC, 0x9878F8, 0xF878F8, 0xF85898, 0xF87858, 0xFCA044, 0xF8B800, 0xB8F818, 0x58D854, 0x58F898, 0x00E8D8, 0x787878, 0x000000, 0x000000,
+		0xFCFCFC, 0xA4E4FC, 0xB8B8F8, 0xD8B8F8, 0xF8B8F8, 0xF8A4C0, 0xF0D0B0, 0xFCE0A8, 0xF8D878, 0xD8F878, 0xB8F8B8, 0xB8F8D8, 0x00FCFC, 0xF8D8F8, 0x000000, 0x000000
+};
+
+// fills in the emphasised colours from the 64 plain ones. each emphasis bit
+// darkens the channels it doesn't name.
+void palette_build(Palette* p, uint32_t colours[PALETTE_COLOURS], enum palette_region region)
+{
+	for (int emphasis=0; emphasis<8; emphasis++) {
+		// the channels as red, green, blue
+		bool kept[3] = { emphasis & 0x01, emphasis & 0x02, emphasis & 0x04 };
+		if (region == palette_pal) {
+			kept[0] = emphasis & 0x02;
+			kept[1] = emphasis & 0x01;
+		}
+		for (int i=0; i<PALETTE_COLOURS; i++) {
+			uint32_t rgba = 0xFF;
+			for (int channel=0; channel<3; channel++) {
+				byte value = colours[i] >> (16 - channel * 8);
+				if (emphasis != 0 && !kept[channel])
+					value = value * PALETTE_EMPHASIS;
+				rgba |= (uint32_t)value << (24 - channel * 8);
+			}
+			p->rgba[emphasis * PALETTE_COLOURS + i] = rgba;
+		}
+	}
+}
+
+void palette_default(Palette* p, enum palette_region region)
+{
+	palette_build(p, EMUDEV_PALETTE, region);
+}
+
+// a .pal file is 64 rgb triplets, or all 512 with the emphasised ones after
+// the plain ones
+int palette_load(Palette* p, char* filename, enum palette_region region)
+{
+	FILE* file = fopen(filename, "rb");
+	if (file == NULL) {
+		printf("couldn't open palette %s\n", filename);
+		return 1;
+	}
+	byte rgb[PALETTE_ENTRIES * 3];
+	size_t size = fread(rgb, 1, sizeof(rgb), file);
+	fclose(file);
+	if (size != PALETTE_COLOURS * 3 && size != PALETTE_ENTRIES * 3) {
+		printf("%s isn't a palette, palettes are %d or %d bytes\n", filename, PALETTE_COLOURS * 3, PALETTE_ENTRIES * 3);
+		return 1;
+	}
+	if (size == PALETTE_ENTRIES * 3) {
+		for (int i=0; i<PALETTE_ENTRIES; i++)
+			p->rgba[i] = (uint32_t)rgb[i*3] << 24 | rgb[i*3+1] << 16 | rgb[i*3+2] << 8 | 0xFF;
+		return 0;
+	}
+	uint32_t colours[PALETTE_COLOURS];
+	for (int i=0; i<PALETTE_COLOURS; i++)
+		colours[i] = rgb[i*3] << 16 | rgb[i*3+1] << 8 | rgb[i*3+2];
+	palette_build(p, colours, region);
+	return 0;
+}
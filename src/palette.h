@@ -0,0 +1,23 @@
+// turning the ppu's colours into rgba. a colour is 6 bits of palette ram with
+// the 3 emphasis bits of PPUMASK above it, so a table of 512 covers them all.
+// entries are packed like SDL_PIXELFORMAT_RGBA8888, 0xRRGGBBAA.
+
+#define PALETTE_COLOURS 64
+#define PALETTE_ENTRIES 512 // every colour under each of the 8 emphasis settings
+#define PALETTE_EMPHASIS 0.816 // what emphasis leaves of the other channels
+
+// pal consoles have the red and green emphasis bits the other way around
+enum palette_region {
+	palette_ntsc,
+	palette_pal,
+};
+
+typedef struct palette {
+	uint32_t rgba[PALETTE_ENTRIES];
+} Palette;
+
+extern uint32_t EMUDEV_PALETTE[PALETTE_COLOURS];
+
+void palette_build(Palette* p, uint32_t colours[PALETTE_COLOURS], enum palette_region region);
+void palette_default(Palette* p, enum palette_region region);
+int palette_load(Palette* p, char* filename, enum palette_region region);
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "types.h"
+#include "systems/system.h"
+#include "chips/2C02.h"
+#include "chips/2C02_kernels.h"
+#include "chips/2A03.h"
+#include "chips/6502.h"
+#include "systems/famicom.h"
+
+// checks each set of ppu kernels the cpu supports against the scalar ones on
+// random tiles, then times them. given a rom, it also checks that drawing the
+// background from the nametable cache gives the same frames as without it,
+// and times whole frames of it with each set and with the cache.
+
+#define BENCH_CHECKS 100000
+#define BENCH_LINES 1000000 // lines expanded when timing
+#define BENCH_SCREENS 10000 // frames of colours looked up when timing
+#define BENCH_FRAMES 600 // frames of the rom
+
+double bench_seconds(struct timespec* start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+bool bench_check(Ppu_kernels* k)
+{
+	byte low[PPU_LINE_TILES], high[PPU_LINE_TILES], palette[PPU_LINE_TILES];
+	byte want[PPU_LINE_TILES * 8], got[PPU_LINE_TILES * 8];
+	word screen[PPU_WIDTH];
+	uint32_t table[512], want_rgba[PPU_WIDTH], got_rgba[PPU_WIDTH];
+	for (int i=0; i<512; i++)
+		table[i] = rand() * 65536u + rand();
+	for (int c=0; c<BENCH_CHECKS; c++) {
+		int n = rand() % (PPU_LINE_TILES + 1);
+		bool flip = rand() & 1;
+		for (int i=0; i<n; i++) {
+			low[i] = rand();
+			high[i] = rand();
+			palette[i] = rand() & 0xFC;
+		}
+		ppu_kernels_scalar.expand(low, high, palette, n, flip, want);
+		k->expand(low, high, palette, n, flip, got);
+		if (memcmp(want, got, n * 8) != 0) {
+			printf("%s: expand differs for %d tiles, flip %d, first %02X %02X %02X\n", k->name, n, flip, low[0], high[0], palette[0]);
+			return false;
+		}
+		n = rand() % (PPU_WIDTH + 1);
+		for (int i=0; i<n; i++)
+			screen[i] = rand() & 0x1FF;
+		ppu_kernels_scalar.colours(screen, table, n, want_rgba);
+		k->colours(screen, table, n, got_rgba);
+		if (memcmp(want_rgba, got_rgba, n * sizeof(uint32_t)) != 0) {
+			printf("%s: colours differ for %d pixels\n", k->name, n);
+			return false;
+		}
+	}
+	return true;
+}
+
+void bench_kernels(Ppu_kernels* k)
+{
+	static byte low[PPU_LINE_TILES], high[PPU_LINE_TILES], palette[PPU_LINE_TILES];
+	static byte pixels[PPU_LINE_TILES * 8];
+	static word screen[PPU_HEIGHT * PPU_WIDTH];
+	static uint32_t table[512], rgba[PPU_HEIGHT * PPU_WIDTH];
+	for (int i=0; i<PPU_LINE_TILES; i++) {
+		low[i] = rand();
+		high[i] = rand();
+		palette[i] = rand() & 0x0C;
+	}
+	for (int i=0; i<PPU_HEIGHT * PPU_WIDTH; i++)
+		screen[i] = rand() & 0x1FF;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	unsigned sum = 0;
+	for (int i=0; i<BENCH_LINES; i++) {
+		k->expand(low, high, palette, PPU_LINE_TILES, false, pixels);
+		sum += pixels[i & 0xFF];
+	}
+	double expand = bench_seconds(&start);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i=0; i<BENCH_SCREENS; i++) {
+		k->colours(screen, table, PPU_HEIGHT * PPU_WIDTH, rgba);
+		sum += rgba[i & 0xFF];
+	}
+	double colours = bench_seconds(&start);
+	printf("%-8s expand %6.1f ns/line   colours %8.1f ns/frame   (%u)\n", k->name, expand * 1e9 / BENCH_LINES, colours * 1e9 / BENCH_SCREENS, sum & 1);
+}
+
+Famicom* bench_load(char* filename)
+{
+	FILE* rom = fopen(filename, "rb");
+	if (rom == NULL) {
+		printf("couldn't open file\n");
+		return NULL;
+	}
+	Famicom* f = famicom_create();
+	if (f == NULL)
+		return NULL;
+	if (famicom_load_rom(f, rom) == 1) {
+		famicom_destroy(f);
+		return NULL;
+	}
+	famicom_reset(f, false);
+	return f;
+}
+
+bool bench_check_cache(char* filename)
+{
+	Famicom* drawn = bench_load(filename);
+	Famicom* cached = bench_load(filename);
+	if (drawn == NULL || cached == NULL || !ppu_cache_background(cached->ppu, true))
+		return false;
+	bool same = true;
+	for (int i=0; i<BENCH_FRAMES && same && drawn->cpu->running; i++) {
+		famicom_run_frame(drawn, false, NULL);
+		famicom_run_frame(cached, false, NULL);
+		if (memcmp(drawn->ppu->screen, cached->ppu->screen, sizeof(drawn->ppu->screen)) != 0) {
+			printf("the cached background differs in frame %d\n", i);
+			same = false;
+		}
+	}
+	famicom_destroy(drawn);
+	famicom_destroy(cached);
+	return same;
+}
+
+void bench_rom(char* filename, Ppu_kernels* k, bool cache)
+{
+	Famicom* f = bench_load(filename);
+	if (f == NULL)
+		return;
+	f->ppu->kernels = k;
+	if (cache && !ppu_cache_background(f->ppu, true))
+		return;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (f->ppu->frame < BENCH_FRAMES && f->cpu->running)
+		famicom_run_frame(f, false, NULL);
+	double seconds = bench_seconds(&start);
+	printf("%-8s%s %llu frames in %.3fs (%.0f fps)\n", k->name, cache ? " cached" : "", (unsigned long long)f->ppu->frame, seconds, f->ppu->frame / seconds);
+	famicom_destroy(f);
+}
+
+int main(int argc, char* argv[])
+{
+	srand(time(NULL));
+	bool ok = true;
+	for (int i=0; ppu_kernels_all[i] != NULL; i++) {
+		Ppu_kernels* k = ppu_kernels_all[i];
+		if (!k->supported()) {
+			printf("%-8s not supported here\n", k->name);
+			continue;
+		}
+		if (!bench_check(k)) {
+			ok = false;
+			continue;
+		}
+		bench_kernels(k);
+	}
+	printf("using %s\n", ppu_kernels_best()->name);
+	if (1 < argc) {
+		if (!bench_check_cache(argv[1]))
+			ok = false;
+		for (int i=0; ppu_kernels_all[i] != NULL; i++) {
+			if (ppu_kernels_all[i]->supported())
+				bench_rom(argv[1], ppu_kernels_all[i], false);
+		}
+		bench_rom(argv[1], ppu_kernels_best(), true);
+	}
+	return ok ? 0 : 1;
+}
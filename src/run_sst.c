@@ -6,9 +6,12 @@
 
 #include "systems/system.h"
 #include "chips/6502.h"
+#include "chips/6502_jit.h"
 #include "systems/sst.h"
 
 FILE* dfh;
+// set by a third "jit" argument, every test is then translated and run as a block
+Jit* jit;
 
 int run_test(int opcode, char* path);
 
@@ -17,6 +20,14 @@ int main(int argc, char* argv[])
 	if (argc < 3) {
 		return 1;
 	}
+	if (3 < argc && strcmp(argv[3], "jit") == 0) {
+		jit = jit_create();
+		if (jit == NULL)
+			return 1;
+		jit_set_code_pages(jit, 0, 0xFF, true);
+		jit_set_hot_threshold(jit, 0);
+		jit_set_block_limit(jit, 1);
+	}
 	char logfilename[255];
 	snprintf(logfilename, sizeof(logfilename), "logs/%02X.log", atoi(argv[2]));
 	dfh = fopen(logfilename, "w");
@@ -31,8 +42,8 @@ int main(int argc, char* argv[])
 
 int run_test(int opcode, char* path)
 {
-	Instruction ins = parse(opcode);
-	if (ins.n == unimplemented) {
+	// a jammed cpu here just stops, the tests expect it to keep reading the bus
+	if (opcodes[opcode].n == unimplemented || opcodes[opcode].n == JAM) {
 		return 0;
 	}
 	char filename[255];
@@ -61,7 +72,7 @@ int run_test(int opcode, char* path)
 	System s;
 	s.s = sst_system;
 	s.h = sst;
-	cpu_reset(sst->cpu, s);
+	sst_cpu_reset(sst, sst->cpu);
 	int tests_amount = cJSON_GetArraySize(test_json);
 	cJSON* test_item;
 	cJSON* test_name;
@@ -81,8 +92,8 @@ int run_test(int opcode, char* path)
 	cJSON* sp_final;
 	cJSON* test_ram_pokes;
 	cJSON* test_ram_pokes_amount;
-	int tests_passed;
-	int tests_failed;
+	int tests_passed = 0;
+	int tests_failed = 0;
 	for (int ti=0; ti<tests_amount; ti++) {
 		test_item = cJSON_GetArrayItem(test_json, ti);
 		test_name = cJSON_GetObjectItem(test_item, "name");
@@ -106,7 +117,7 @@ int run_test(int opcode, char* path)
 		sst->cpu->reg[reg_a] = (byte)a_initial->valueint;
 		sst->cpu->reg[reg_x] = (byte)x_initial->valueint;
 		sst->cpu->reg[reg_y] = (byte)y_initial->valueint;
-		sst->cpu->reg[reg_p] = (byte)p_initial->valueint;
+		cpu_set_p(sst->cpu, (byte)p_initial->valueint);
 		sst->cpu->reg[reg_sp] = (byte)sp_initial->valueint;
 		memset( sst->ram, 0, sizeof(byte) * sizeof(sst->ram) );
 		cJSON* ram_poke;
@@ -124,15 +135,44 @@ int run_test(int opcode, char* path)
 			fprintf(dfh, "%X->%X\n", addr, value);
 		}
 		write_cpu_state(sst->cpu, s, dfh);
-		ins = parse(opcode);
-		byte oper[2] = {
-			mmap_sst(sst, sst->cpu->pc+1, 0, false),
-			mmap_sst(sst, sst->cpu->pc+2, 0, false),
-		};
-		step(s, sst->cpu, ins, oper);
+		sst->cycle_count = 0;
+		sst->cpu->cycles = 0;
+		int cycles_run;
+		if (jit != NULL) {
+			// translated code doesn't fetch what it inlines, so only the count can be checked
+			jit_invalidate(jit, sst->cpu->pc, sst->cpu->pc);
+			if (jit_run(jit, s, sst->cpu, 1) == 0)
+				sst_cpu_step(sst, sst->cpu);
+			cycles_run = sst->cpu->cycles;
+		} else {
+			sst_cpu_step(sst, sst->cpu);
+			cycles_run = sst->cycle_count;
+		}
 		write_cpu_state(sst->cpu, s, dfh);
 		cJSON* ram_final = cJSON_GetObjectItem(test_final, "ram");
 		int score = 10;
+		cJSON* test_cycles = cJSON_GetObjectItem(test_item, "cycles");
+		if (test_cycles != NULL) {
+			int cycles_expected = cJSON_GetArraySize(test_cycles);
+			if (cycles_run != cycles_expected) {
+				fprintf(dfh, "ran %d cycles, expected %d\n", cycles_run, cycles_expected);
+				score--;
+			} else if (jit == NULL) {
+				for (int ci=0; ci<cycles_expected && ci<SST_MAX_CYCLES; ci++) {
+					cJSON* cycle = cJSON_GetArrayItem(test_cycles, ci);
+					word addr = (word)cJSON_GetArrayItem(cycle, 0)->valueint;
+					byte value = (byte)cJSON_GetArrayItem(cycle, 1)->valueint;
+					bool write = strcmp(cJSON_GetArrayItem(cycle, 2)->valuestring, "write") == 0;
+					if (sst->cycles[ci].addr != addr || sst->cycles[ci].value != value || sst->cycles[ci].write != write) {
+						fprintf(dfh, "cycle %d is %X %X %s, expected %X %X %s\n", ci,
+							sst->cycles[ci].addr, sst->cycles[ci].value, sst->cycles[ci].write ? "write" : "read",
+							addr, value, write ? "write" : "read");
+						score--;
+						break;
+					}
+				}
+			}
+		}
 		for (int ri2=0; ri2<cJSON_GetArraySize(ram_final); ri2++) {
 			cJSON* ram_peek = cJSON_GetArrayItem(ram_final, ri2);
 			cJSON* ram_addr;
@@ -155,6 +195,8 @@ int run_test(int opcode, char* path)
 			char* reg;
 			if (ri3 == 5) {
 				actual = sst->cpu->pc;
+			} else if (ri3 == reg_p) {
+				actual = cpu_get_p(sst->cpu);
 			} else {
 				actual = sst->cpu->reg[ri3];
 			}
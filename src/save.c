@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "types.h"
+#include "save.h"
+
+// makes the rename itself survive a crash, not just the file's contents
+static void save_sync_dir(char* filename)
+{
+	char* slash = strrchr(filename, '/');
+	char* dir = slash == NULL ? strdup(".") : strndup(filename, slash - filename + 1);
+	if (dir == NULL)
+		return;
+	int fd = open(dir, O_RDONLY);
+	if (fd != -1) {
+		fsync(fd);
+		close(fd);
+	}
+	free(dir);
+}
+
+static int save_write(Save* s)
+{
+	FILE* f = fopen(s->temp, "wb");
+	if (f == NULL) {
+		printf("couldn't write save %s\n", s->temp);
+		return 1;
+	}
+	bool ok = fwrite(s->taken, 1, s->size, f) == (size_t)s->size && fflush(f) == 0 && fsync(fileno(f)) == 0;
+	if (fclose(f) != 0 || !ok || rename(s->temp, s->filename) != 0) {
+		printf("couldn't write save %s\n", s->filename);
+		remove(s->temp);
+		return 1;
+	}
+	save_sync_dir(s->filename);
+	return 0;
+}
+
+// the writer thread. it takes the newest copy, writes it if it isn't what's
+// in the file already, then waits out SAVE_INTERVAL_MS before taking another
+static void* save_writer(void* data)
+{
+	Save* s = data;
+	pthread_mutex_lock(&s->lock);
+	for (;;) {
+		while (!s->waiting && !s->quit)
+			pthread_cond_wait(&s->wake, &s->lock);
+		if (!s->waiting)
+			break;
+		memcpy(s->taken, s->pending, s->size);
+		s->waiting = false;
+		pthread_mutex_unlock(&s->lock);
+		if (memcmp(s->taken, s->written, s->size) != 0 && save_write(s) == 0)
+			memcpy(s->written, s->taken, s->size);
+		pthread_mutex_lock(&s->lock);
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_sec += SAVE_INTERVAL_MS / 1000;
+		until.tv_nsec += SAVE_INTERVAL_MS % 1000 * 1000000L;
+		if (1000000000L <= until.tv_nsec) {
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+		while (!s->quit) {
+			if (pthread_cond_timedwait(&s->wake, &s->lock, &until) == ETIMEDOUT)
+				break;
+		}
+	}
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+static void save_free(Save* s)
+{
+	free(s->filename);
+	free(s->temp);
+	free(s->pending);
+	free(s->taken);
+	free(s->written);
+	free(s);
+}
+
+// the ram's filled in from filename if there's a save there already
+Save* save_open(char* filename, byte* ram, int size)
+{
+	Save* s = calloc(1, sizeof(Save));
+	if (s == NULL) {
+		printf("couldn't allocate memory\n");
+		return NULL;
+	}
+	s->size = size;
+	s->filename = strdup(filename);
+	s->temp = malloc(strlen(filename) + 5);
+	s->pending = malloc(size);
+	s->taken = malloc(size);
+	s->written = malloc(size);
+	if (s->filename == NULL || s->temp == NULL || s->pending == NULL || s->taken == NULL || s->written == NULL) {
+		printf("couldn't allocate memory\n");
+		save_free(s);
+		return NULL;
+	}
+	sprintf(s->temp, "%s.tmp", filename);
+	FILE* f = fopen(filename, "rb");
+	if (f != NULL) {
+		size_t got = fread(ram, 1, size, f);
+		if (got != (size_t)size || fgetc(f) != EOF)
+			printf("save %s isn't the %d bytes the cart has, using what fits\n", filename, size);
+		fclose(f);
+	}
+	memcpy(s->written, ram, size);
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->wake, NULL);
+	if (pthread_create(&s->writer, NULL, save_writer, s) != 0) {
+		printf("couldn't start the save writer\n");
+		pthread_mutex_destroy(&s->lock);
+		pthread_cond_destroy(&s->wake);
+		save_free(s);
+		return NULL;
+	}
+	return s;
+}
+
+// hands the writer a copy of ram. returns false without waiting if the writer
+// has the copy locked, the caller tries again later.
+bool save_update(Save* s, byte* ram)
+{
+	if (pthread_mutex_trylock(&s->lock) != 0)
+		return false;
+	memcpy(s->pending, ram, s->size);
+	s->waiting = true;
+	pthread_cond_signal(&s->wake);
+	pthread_mutex_unlock(&s->lock);
+	return true;
+}
+
+// writes ram one last time if it's changed, and waits for it
+void save_close(Save* s, byte* ram)
+{
+	pthread_mutex_lock(&s->lock);
+	memcpy(s->pending, ram, s->size);
+	s->waiting = true;
+	s->quit = true;
+	pthread_cond_signal(&s->wake);
+	pthread_mutex_unlock(&s->lock);
+	pthread_join(s->writer, NULL);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->wake);
+	save_free(s);
+}
+
+// the rom's name with .sav for its extension
+char* save_filename(char* rom)
+{
+	char* slash = strrchr(rom, '/');
+	char* dot = strrchr(rom, '.');
+	int length = dot != NULL && (slash == NULL || slash < dot) ? dot - rom : (long)strlen(rom);
+	char* filename = malloc(length + 5);
+	if (filename == NULL)
+		return NULL;
+	memcpy(filename, rom, length);
+	strcpy(filename + length, ".sav");
+	return filename;
+}
@@ -0,0 +1,25 @@
+// battery backed ram kept in a file. the emulation hands over a copy when the
+// ram's changed and a thread of its own writes it out, so the emulation never
+// waits on the disk. the file is written beside the old one and renamed over
+// it, so a crash leaves either the old save or the new one, never half of each.
+
+#define SAVE_INTERVAL_MS 1000 // at most one write this often, games that keep writing are coalesced
+
+typedef struct save {
+	char* filename;
+	char* temp; // written first, then renamed to filename
+	int size;
+	byte* pending; // the newest copy handed over, under lock
+	bool waiting; // pending hasn't been taken by the writer yet
+	bool quit;
+	byte* taken; // the writer's, what it's writing
+	byte* written; // the writer's, what's in the file
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_t writer;
+} Save;
+
+Save* save_open(char* filename, byte* ram, int size);
+bool save_update(Save* s, byte* ram);
+void save_close(Save* s, byte* ram);
+char* save_filename(char* rom);
@@ -9,6 +9,12 @@
 #include "../chips/6502.h"
 #include "apple1.h"
 
+#define CORE_MACHINE Apple1
+#define CORE_BUS mmap_apple1
+#define CORE_PREFIX apple1_cpu_
+#define CORE_DECIMAL
+#include "../chips/6502_core.h"
+
 const int memsize_apple1 = 0x0FFF;
 
 const byte wozmon[] = {
@@ -76,11 +82,8 @@ void apple1_destroy(Apple1* apple1)
 
 void apple1_reset(Apple1* apple1)
 {
-	System system;
-	system.s = apple1_system;
-	system.h = apple1;
 	memset( apple1->mem, 0, sizeof(byte) * memsize_apple1 );
-	cpu_reset(apple1->cpu, system);
+	apple1_cpu_reset(apple1, apple1->cpu);
 }
 
 byte mmap_apple1(Apple1* apple1, word addr, byte value, bool write)
@@ -114,31 +117,5 @@ byte mmap_apple1(Apple1* apple1, word addr, byte value, bool write)
 
 void apple1_step(Apple1* apple1)
 {
-	System system; system.s = apple1_system; system.h = apple1;
-	apple1->cpu->branch_taken = false;
-	Instruction i = parse(mmap_apple1(apple1, apple1->cpu->pc, 0, false));
-	if (i.n == unimplemented) {
-		printf("unimplemented opcode %X!\n", mmap_apple1(apple1, apple1->cpu->pc, 0, false));
-		apple1->cpu->running = false;
-		return;
-	}
-	byte oper1 = mmap_apple1(apple1, apple1->cpu->pc + 1, 0, false);
-	byte oper2 = 0;
-	word opera = 0;
-	switch (i.a) {
-	default:
-		break;
-	case absolute:
-	case absolute_indirect:
-	case absolute_x:
-	case absolute_y:
-		oper2 = mmap_apple1(apple1, apple1->cpu->pc + 2, 0, false);
-		opera = bytes_to_word(oper2, oper1);
-		break;
-	}
-	byte oper[2] = {oper1, oper2};
-	apple1->cpu->oper[0] = oper1;
-	apple1->cpu->oper[1] = oper2;
-	apple1->cpu->current_instruction = i;
-	step(system, apple1->cpu, i, oper);
+	apple1_cpu_step(apple1, apple1->cpu);
 }
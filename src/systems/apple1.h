@@ -9,3 +9,8 @@ void apple1_reset(Apple1* apple1);
 void apple1_destroy(Apple1* apple1);
 void apple1_step (Apple1* apple1);
 byte mmap_apple1(Apple1* apple1, word addr, byte value, bool write);
+void apple1_cpu_reset(Apple1* apple1, Cpu_6502* cpu);
+void apple1_cpu_interrupt(Apple1* apple1, Cpu_6502* cpu);
+void apple1_cpu_decode(Apple1* apple1, Cpu_6502* cpu, Decoded_instruction* d);
+void apple1_cpu_execute(Apple1* apple1, Cpu_6502* cpu, Decoded_instruction* d);
+void apple1_cpu_step(Apple1* apple1, Cpu_6502* cpu);
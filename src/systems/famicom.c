@@ -3,24 +3,46 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <pthread.h>
 #include "../types.h"
 #include "../bitmath.h"
 #include "system.h"
 #include "../chips/2C02.h"
+#include "../chips/2A03.h"
 #include "../chips/6502.h"
+#include "../chips/6502_jit.h"
+#include "rom.h"
 #include "famicom.h"
+
+#define CORE_MACHINE Famicom
+#define CORE_BUS mmap_famicom
+#define CORE_PREFIX famicom_cpu_
+#include "../chips/6502_core.h"
 #define SET_BIT(b,i) (b | 1 << i)
 #define CLEAR_BIT(b,i) (b & ~(1 << i))
 #define GET_BIT(b,i) (b>>i) & 1;
 
 const int memsize_famicom = 0x0800;
 
+// the dmc fetches its samples over the cpu's bus
+static byte famicom_dmc_read(void* machine, word addr)
+{
+	return mmap_famicom(machine, addr, 0, false);
+}
+
 Famicom* famicom_create ()
 {
-	Famicom* famicom = malloc(sizeof(Famicom));
+	// zeroed, so the controllers and anything else not set below start cleared
+	Famicom* famicom = calloc(1, sizeof(Famicom));
+	if (famicom == NULL) {
+		printf("couldn't allocate memory\n");
+		return NULL;
+	}
 	famicom->mem = malloc( sizeof(byte) * memsize_famicom );
 	famicom->cpu = (Cpu_6502*) malloc(sizeof(Cpu_6502));
 	famicom->ppu = (Famicom_ppu*) malloc(sizeof(Famicom_ppu));
+	famicom->apu = (Famicom_apu*) malloc(sizeof(Famicom_apu));
 	if (famicom->mem == NULL) {
 		free(famicom);
 		printf("couldn't allocate memory\n");
@@ -32,17 +54,76 @@ Famicom* famicom_create ()
 		printf("couldn't allocate memory\n");
 		return NULL;
 	}
-	if (famicom->ppu == NULL) {
+	if (famicom->ppu == NULL || famicom->apu == NULL) {
 		free(famicom->mem);
 		free(famicom->cpu);
+		free(famicom->ppu);
+		free(famicom->apu);
 		free(famicom);
 		printf("couldn't allocate memory\n");
 		return NULL;
 	}
 	famicom->cpu->running = false;
+	famicom->rom = NULL;
+	famicom->prg = NULL;
+	famicom->chr = NULL;
+	famicom->chr_ram = false;
+	famicom->prg_ram = NULL;
+	famicom->prg_ram_size = 0;
+	famicom->prg_ram_dirty = false;
+	ppu_set_mirroring(famicom->ppu, mirroring_horizontal);
+	famicom->ppu->cache = NULL;
+	famicom->apu->machine = famicom;
+	famicom->apu->read = famicom_dmc_read;
+	memset(famicom->decode_cache, 0, sizeof(famicom->decode_cache));
+	famicom->ram_decode_pages = 0;
+	famicom->jit = NULL;
+	famicom->skip_idle = true;
+	famicom->bus_effects = 0;
+	famicom->next_event = UINT64_MAX;
+	famicom->ppu_event = UINT64_MAX;
+	famicom->ppu_cycle = 0;
+	famicom->apu_event = UINT64_MAX;
 	return famicom;
 }
 
+void famicom_set_button(Famicom_controller* c, int button, bool pressed)
+{
+	switch (button) {
+	case joypad_a:
+		c->button_a = pressed;
+		break;
+	case joypad_b:
+		c->button_b = pressed;
+		break;
+	case joypad_select:
+		c->select = pressed;
+		break;
+	case joypad_start:
+		c->start = pressed;
+		break;
+	case joypad_up:
+		c->up = pressed;
+		break;
+	case joypad_down:
+		c->down = pressed;
+		break;
+	case joypad_left:
+		c->left = pressed;
+		break;
+	case joypad_right:
+		c->right = pressed;
+		break;
+	}
+}
+
+// buttons has a bit for each of famicom_joypad_buttons
+void famicom_set_buttons(Famicom_controller* c, byte buttons)
+{
+	for (int i=joypad_a; i<=joypad_right; i++)
+		famicom_set_button(c, i, buttons >> i & 1);
+}
+
 void famicom_reset_controller(Famicom* f)
 {
 	f->controller_p1.right = false;
@@ -58,121 +139,310 @@ void famicom_reset_controller(Famicom* f)
 
 void famicom_reset (Famicom* famicom, bool warm)
 {
-	System system; system.s = famicom_system; system.h = famicom;
-	if (!warm) {
+	if (!warm)
 		memset( famicom->mem, 0, sizeof(byte) * memsize_famicom );
-		memset( famicom->ppu->nametable, 0, sizeof(byte) * sizeof(famicom->ppu->nametable) );
-		memset( famicom->ppu->attribute_table, 0, sizeof(byte) * sizeof(famicom->ppu->attribute_table) );
-		memset( famicom->ppu->oam, 0, sizeof(byte) * sizeof(famicom->ppu->oam) );
-		memset( famicom->ppu->palettes, 0, sizeof(byte) * sizeof(famicom->ppu->palettes) );
-	}
+	ppu_reset(famicom->ppu, warm);
+	famicom->prg_bank = 0;
+	famicom_invalidate_decode_cache(famicom, 0, 0xFF);
 	famicom->cycles = 0;
-	famicom->ppu->vblank_flag = false;
-	famicom->ppu->nmi_enable = false;
-	famicom->ppu->write_latch = false;
-	famicom->ppu->vram_addr = 0;
-	famicom->ppu->vram_increment =false;
-	famicom->ppu->sprite_pattern_table = false;
-	famicom->ppu->bg_pattern_table = false;
-	famicom->ppu->address = 0;
-	famicom->ppu->nametable_base = 0;
-	famicom->ppu->scroll_x = 0;
-	famicom->ppu->scroll_y = 0;
-	famicom->apu.pulse1_timer = 0;
-	famicom->apu.pulse2_timer = 0;
-	famicom->apu.tri_timer = 0;
 	famicom_reset_controller(famicom);
-	cpu_reset(famicom->cpu, system);
+	famicom_cpu_reset(famicom, famicom->cpu);
+	famicom->ppu_cycle = famicom->cpu->cycles;
+	apu_reset(famicom->apu, warm);
+	famicom_update_apu_irq(famicom);
 }
 
 
+static void famicom_release_rom(Famicom* famicom)
+{
+	if (famicom->chr_ram)
+		free(famicom->chr);
+	rom_release(famicom->rom);
+	famicom->rom = NULL;
+	famicom->prg = NULL;
+	famicom->chr = NULL;
+	famicom->chr_ram = false;
+	free(famicom->prg_ram);
+	famicom->prg_ram = NULL;
+	famicom->prg_ram_size = 0;
+	famicom->prg_ram_dirty = false;
+}
+
 void famicom_destroy (Famicom* famicom)
 {
 	free(famicom->mem);
-	free(famicom->prg);
-	free(famicom->chr);
-	free(famicom->chr_window);
+	famicom_release_rom(famicom);
+	for (int i=0; i<256; i++)
+		free(famicom->decode_cache[i]);
+	jit_destroy(famicom->jit);
+	ppu_cache_background(famicom->ppu, false);
 	free(famicom->ppu);
+	free(famicom->apu);
 	free(famicom->cpu);
 	free(famicom);
 }
 
-int famicom_load_rom (Famicom* famicom, FILE* rom)
+// runs from image from now on. the famicom takes the caller's reference to it
+// if this succeeds, only chr ram is its own.
+int famicom_attach_rom(Famicom* famicom, Rom_image* image)
 {
-	byte header[16];
-	fread(header, sizeof(byte), 16, rom);
-	if (header[0] == 'N' && header[1] == 'E' && header[2] == 'S' && header[3] == 0x1A) {
-		int prg_size = header[4] * 16384;
-		int chr_size = header[5] * 8192;
-		famicom->prg_size = prg_size;
-		famicom->chr_size = chr_size;
-		byte mapper_lo = (header[6] & 0xF0) >> 4;
-		byte mapper_hi = header[7] & 0xF0;
-		int mapper = (mapper_hi | mapper_lo);
-		famicom->loaded_rom.mapper = mapper;
-		int mirroring = header[6] & 0x01;
-		famicom->loaded_rom.mirroring = mirroring;
-		printf("NES rom, mapper: %d, \nprg size: %d, chr size: %d, mirroring: %d\n", mapper, prg_size, chr_size, mirroring);
-		switch (mapper) {
-		case 0:
-		case 3:
-			famicom->prg = (byte*)malloc(sizeof(byte) * prg_size);
-			if (!famicom->prg) {
-				printf("error allocating prg\n");
-				fclose(rom);
-				return 1;
-			}
-			fseek(rom, 16, SEEK_SET);
-			fread(famicom->prg, sizeof(byte), prg_size, rom);
-			famicom->chr = (byte*)malloc(sizeof(byte) * chr_size);
-			if (famicom->chr == NULL) {
-				free(famicom->prg);
-				printf("error allocating chr\n");
-				fclose(rom);
-				return 1;
-			}
-			fseek(rom, 16 + prg_size, SEEK_SET);
-			fread(famicom->chr, sizeof(byte), chr_size, rom);
-			famicom->chr_window = (byte*) malloc(sizeof(byte) * 8192);
-			memcpy(famicom->chr_window, famicom->chr, 8192);
-			break;
-		default:
-			printf("unsupported mapper\n");
-			fclose(rom);
+	switch (image->mapper) {
+	case 0:
+	case 2:
+	case 3:
+		break;
+	default:
+		printf("unsupported mapper\n");
+		return 1;
+	}
+	// nes 2.0 can give any size, these mappers only switch whole banks
+	if (image->prg_size % ROM_PRG_BANK != 0 || image->chr_size % ROM_CHR_BANK != 0) {
+		printf("prg or chr isn't a whole number of banks\n");
+		return 1;
+	}
+	// carts without chr rom have chr ram instead, 8 KB unless it says more
+	byte* chr = image->chr;
+	if (image->chr_size == 0) {
+		chr = calloc(image->chr_ram_size > ROM_CHR_BANK ? image->chr_ram_size : ROM_CHR_BANK, sizeof(byte));
+		if (chr == NULL) {
+			printf("error allocating chr\n");
 			return 1;
 		}
-		fclose(rom);
-		return 0;
+	}
+	// a trainer goes at $7000, so there has to be ram there for it
+	int prg_ram_size = image->prg_ram_size;
+	if (image->trainer != NULL && prg_ram_size < ROM_PRG_RAM)
+		prg_ram_size = ROM_PRG_RAM;
+	byte* prg_ram = NULL;
+	if (prg_ram_size != 0) {
+		prg_ram = calloc(prg_ram_size, sizeof(byte));
+		if (prg_ram == NULL) {
+			if (image->chr_size == 0)
+				free(chr);
+			printf("error allocating prg ram\n");
+			return 1;
+		}
+		if (image->trainer != NULL)
+			memcpy(prg_ram + 0x1000, image->trainer, ROM_TRAINER);
+	}
+	famicom_release_rom(famicom);
+	famicom->rom = image;
+	famicom->prg = image->prg;
+	famicom->chr = chr;
+	famicom->chr_ram = image->chr_size == 0;
+	famicom->prg_ram = prg_ram;
+	famicom->prg_ram_size = prg_ram_size;
+	famicom->prg_size = image->prg_size;
+	famicom->chr_size = image->chr_size;
+	famicom->loaded_rom.mapper = image->mapper;
+	famicom->loaded_rom.mirroring = image->mirroring;
+	ppu_set_mirroring(famicom->ppu, image->mirroring);
+	ppu_set_chr(famicom->ppu, chr, famicom->chr_ram);
+	return 0;
+}
+void famicom_print_rom(Rom_image* image)
+{
+	printf("%s rom, mapper: %d.%d, \nprg size: %d, chr size: %d, mirroring: %d\n", image->nes2 ? "NES 2.0" : "NES", image->mapper, image->submapper, image->prg_size, image->chr_size, image->mirroring);
+	if (image->battery || image->trainer != NULL)
+		printf("prg ram: %d, battery: %d, trainer: %d\n", image->prg_ram_size, image->battery, image->trainer != NULL);
+}
+
+// loads a rom of the famicom's own from the rest of rom, and closes it
+int famicom_load_rom (Famicom* famicom, FILE* rom)
+{
+	Rom_image* image = rom_read(rom, "");
+	if (image == NULL)
+		return 1;
+	if (famicom_attach_rom(famicom, image) == 1) {
+		rom_release(image);
+		return 1;
+	}
+	famicom_print_rom(image);
+	return 0;
+}
+
+// the ppu holds the nmi line while it's in vblank with nmis enabled, the cpu
+// takes one each time that starts
+static void famicom_update_nmi(Famicom* f)
+{
+	cpu_set_nmi(f->cpu, ppu_nmi(f->ppu));
+}
+
+// an irq the apu has raised is put on the line. one still to come goes on it
+// ahead of time, with the cycle it comes on, once the next instruction could
+// get that far, so neither the jit nor skipping idle loops can run past it.
+static void famicom_apu_irq_source(Famicom* f, byte source, bool raised, uint64_t at)
+{
+	if (raised) {
+		cpu_set_irq(f->cpu, source, true);
+	} else if (at <= f->cpu->cycles + FAMICOM_IRQ_LEAD) {
+		cpu_set_irq_at(f->cpu, source, at);
 	} else {
-		printf("not an NES rom\n");
+		cpu_set_irq(f->cpu, source, false);
+		if (at < f->apu_event)
+			f->apu_event = at;
+	}
+}
+
+// whichever of the ppu's next event and the point the apu's next irq has to
+// be put on the line comes first
+void famicom_update_next_event(Famicom* f)
+{
+	f->next_event = f->apu_event == UINT64_MAX ? UINT64_MAX : f->apu_event - FAMICOM_IRQ_LEAD;
+	if (f->ppu_event < f->next_event)
+		f->next_event = f->ppu_event;
+}
+
+void famicom_update_apu_irq(Famicom* f)
+{
+	// while the line is only held ahead of time, both irqs are put back from
+	// scratch, so one that's been called off doesn't leave the other early
+	if (f->cpu->irq_lines != 0 && f->cpu->cycles < f->cpu->irq_cycle)
+		cpu_set_irq(f->cpu, famicom_irq_apu_frame | famicom_irq_dmc, false);
+	f->apu_event = UINT64_MAX;
+	famicom_apu_irq_source(f, famicom_irq_apu_frame, f->apu->frame_irq, apu_frame_irq_at(f->apu));
+	famicom_apu_irq_source(f, famicom_irq_dmc, f->apu->dmc_irq, apu_dmc_irq_at(f->apu));
+	famicom_update_next_event(f);
+}
+
+// for running without a ppu clock
+void famicom_set_vblank(Famicom* f, bool vblank)
+{
+	if (vblank)
+		f->ppu->status |= PPUSTATUS_VBLANK;
+	else
+		f->ppu->status &= ~PPUSTATUS_VBLANK;
+	famicom_update_nmi(f);
+}
+
+void famicom_ppu_tick(Famicom* f)
+{
+	ppu_tick(f->ppu);
+	famicom_update_nmi(f);
+}
+
+// runs the ppu 3 dots a cycle up to where the cpu is
+static void famicom_ppu_run(Famicom* f)
+{
+	for (; f->ppu_cycle < f->cpu->cycles; f->ppu_cycle++) {
+		famicom_ppu_tick(f);
+		famicom_ppu_tick(f);
+		famicom_ppu_tick(f);
 	}
-	fclose(rom); // not an NES rom
-	return 1;
+}
+
+// before the cpu touches the ppu, or anything it draws from
+static void famicom_ppu_catch_up(Famicom* f)
+{
+	if (f->ppu_event != UINT64_MAX)
+		famicom_ppu_run(f);
+}
+
+// a write can change when the ppu's next event is, so the step stops after
+// the instruction and it's worked out again
+static void famicom_ppu_changed(Famicom* f)
+{
+	if (f->ppu_event != UINT64_MAX) {
+		f->ppu_event = f->cpu->cycles;
+		famicom_update_next_event(f);
+	}
+}
+
+// runs the cpu up to each of the ppu's events in turn, and the ppu up to the
+// cpu in between, until the ppu starts another frame. the ppu's caught up
+// early whenever the cpu touches it.
+void famicom_run_frame(Famicom* f, bool debug, FILE* dfh)
+{
+	uint64_t frame = f->ppu->frame;
+	while (f->cpu->running) {
+		famicom_ppu_run(f);
+		if (f->ppu->frame != frame)
+			break;
+		f->ppu_event = f->ppu_cycle + (ppu_next_event(f->ppu) + 2) / 3;
+		famicom_update_next_event(f);
+		famicom_step(f, INT_MAX, debug, dfh);
+	}
+	f->ppu_event = UINT64_MAX;
+	famicom_update_next_event(f);
 }
 
 const word ppu_addr_start = 0x2000;
 const word apu_addr_start = 0x4000;
 const word unmapped_addr_start = 0x4020;
 
-enum ppu_mmapped_register {
-	PPUCTRL,
-	PPUMASK,
-	PPUSTATUS,
-	OAMADDR,
-	OAMDATA,
-	PPUSCROLL,
-	PPUADDR,
-	PPUDATA,
-};
-
 void oamdma(Famicom* f, byte value);
+
+void famicom_invalidate_decode_cache(Famicom* f, int first_page, int last_page)
+{
+	for (int i=first_page; i<=last_page; i++) {
+		if (f->decode_cache[i] != NULL)
+			memset(f->decode_cache[i], 0, sizeof(Decoded_instruction) * 256);
+	}
+	if (f->jit != NULL)
+		jit_invalidate(f->jit, first_page << 8, (last_page << 8) | 0xFF);
+}
+
+// translates hot code in prg rom from now on. everything else, including code in
+// ram, is still interpreted. returns false if the jit isn't available here.
+bool famicom_enable_jit(Famicom* f)
+{
+	if (f->jit == NULL)
+		f->jit = jit_create();
+	if (f->jit == NULL)
+		return false;
+	jit_set_code_pages(f->jit, 0x80, 0xFF, true);
+	return true;
+}
+
+// a write to ram can change the last byte of an instruction starting up to two bytes before it
+void famicom_invalidate_ram_code(Famicom* f, word addr)
+{
+	for (int i=0; i<3; i++) {
+		word a = (addr - i) & 0x7FF;
+		if (f->decode_cache[a >> 8] != NULL)
+			f->decode_cache[a >> 8][a & 0xFF].length = 0;
+	}
+}
+
+// returns the cached decoding of the instruction at pc, fetching it on a miss.
+// a hit skips the fetch, which is free of side effects in rom and ram, but still
+// takes its cycles. returns NULL where code can't be cached.
+Decoded_instruction* famicom_decode_cached(Famicom* f)
+{
+	word pc = f->cpu->pc;
+	int page;
+	if (pc < ppu_addr_start - 2) {
+		page = (pc % 0x800) >> 8;
+	} else if (0x8000 <= pc && pc < 0xFFFE) {
+		page = pc >> 8;
+	} else {
+		return NULL;
+	}
+	if (f->decode_cache[page] == NULL) {
+		f->decode_cache[page] = calloc(256, sizeof(Decoded_instruction));
+		if (f->decode_cache[page] == NULL)
+			return NULL;
+		if (page < 0x80)
+			f->ram_decode_pages++;
+	}
+	Decoded_instruction* d = &f->decode_cache[page][pc & 0xFF];
+	if (d->length == 0) {
+		famicom_cpu_decode(f, f->cpu, d);
+	} else {
+		f->cpu->cycles += d->fetch_cycles;
+	}
+	return d;
+}
+
 byte mmap_famicom(Famicom* f, word addr, byte value, bool write)
 {
-	byte ppustatus = 0;
 	 // zero page
 	if (addr < ppu_addr_start) {
 		if (write) {
 			f->mem[addr % 0x800] = value;
+			f->bus_effects++;
+			if (f->ram_decode_pages != 0)
+				famicom_invalidate_ram_code(f, addr);
 			return 0;
 		} else {
 			return f->mem[addr % 0x800];
@@ -180,118 +450,38 @@ byte mmap_famicom(Famicom* f, word addr, byte value, bool write)
 	// PPU registers
 	} else if (addr < apu_addr_start) {
 		byte ppu_reg = get_lower_byte(addr) % 8;
-		switch (ppu_reg) {
-		case PPUCTRL:
-			if (write) {
-				f->ppu->vram_increment = GET_BIT(value, 2);
-				f->ppu->sprite_pattern_table = GET_BIT(value, 3);
-				f->ppu->bg_pattern_table = GET_BIT(value, 4);
-				f->ppu->nmi_enable = value & 0x80;
-				f->ppu->nametable_base = value & 0x03;
-				return 0;
-			}
-			break;
-		case PPUMASK:
-			return 0;
-		case PPUSTATUS:
-			ppustatus = set_bit(ppustatus, 7, f->ppu->vblank_flag);
-			f->ppu->vblank_flag = false;
-			f->ppu->write_latch = false;
-			return ppustatus;
-		case OAMADDR:
-			if (write) {
-				f->ppu->oam_address = value;
-			}
-			return 0;
-		case OAMDATA:
-			if (write) {
-			}
-			return 0;
-		case PPUSCROLL:
-			if (write) {
-				if (f->ppu->write_latch) {
-					f->ppu->scroll_y = value;
-				} else {
-					f->ppu->scroll_x = value;
-				}
-			}
-			f->ppu->write_latch = !f->ppu->write_latch;
-			return 0;
-		case PPUADDR:
-			if (write) {
-				if (f->ppu->write_latch) {
-					f->ppu->address = bytes_to_word(f->ppu->vram_addr, value) % 0x4000;
-				} else {
-					f->ppu->vram_addr = value;
-				}
-			}
-			f->ppu->write_latch = !f->ppu->write_latch;
-			return 0;
-		case PPUDATA:
-			if (write) {
-				word address = f->ppu->address;
-				if (0x1FFF < address && address < 0x23C0) {
-					f->ppu->nametable[0][address - 0x2000] = value;
-				} else if (0x23BF < address && address < 0x2400) {
-					f->ppu->attribute_table[0][address - 0x23C0] = value;
-				} else if (0x2400 <= address && address < 0x27C0) {
-					f->ppu->nametable[1][address - 0x2400] = value;
-				} else if (0x27BF < address && address < 0x2800) {
-					f->ppu->attribute_table[1][address - 0x27C0] = value;
-				} else if (0x2800 <= address && address <= 0x2BBF) {
-					f->ppu->nametable[2][address - 0x2800] = value;
-				} else if (0x2BC0 <= address && address <= 0x2BFF) {
-					f->ppu->attribute_table[2][address - 0x2BC0] = value;
-				} else if (0x3F00 < address && address < 0x3F20 ) {
-					f->ppu->palettes[address - 0x3F00] = value;
-				}
-				if (f->ppu->vram_increment) {
-					f->ppu->address += 32;
-				} else {
-					f->ppu->address += 1;
-				}
-				f->ppu->address = f->ppu->address % 0x4000;
-			}
-			return 0;
+		// reading the status has the same effect every time, so loops can poll it
+		if (write || ppu_reg != PPUSTATUS)
+			f->bus_effects++;
+		famicom_ppu_catch_up(f);
+		if (write) {
+			ppu_write_register(f->ppu, ppu_reg, value);
+			famicom_ppu_changed(f);
+		} else {
+			value = ppu_read_register(f->ppu, ppu_reg);
 		}
+		if (ppu_reg == PPUCTRL || ppu_reg == PPUSTATUS)
+			famicom_update_nmi(f);
+		return write ? 0 : value;
 	// APU & OAMDMA
 	} else if (addr < unmapped_addr_start) {
+		f->bus_effects++;
 		switch (addr) {
 		case 0x4014:
 			if (write) {
+				famicom_ppu_catch_up(f);
 				oamdma(f, value);
+				famicom_ppu_changed(f);
 			}
 			return 0;
-		case 0x4002:
-			if (write) {
-				f->apu.pulse1_timer = value;
-			}
-			return 0;
-		case 0x4003:
-			if (write) {
-				f->apu.pulse1_timer = ((f->apu.pulse1_timer << 3) | value);
-			}
-			return 0;
-		case 0x4006:
-			if (write) {
-				f->apu.pulse2_timer = value;
-			}
-			return 0;
-		case 0x4007:
-			if (write) {
-				f->apu.pulse2_timer = ((f->apu.pulse2_timer << 3) | value);
-			}
-			return 0;
-		case 0x4008:
-			if (write) {
-				f->apu.tri_timer = value;
-			}
-			return 0;
-		case 0x400B:
-			if (write) {
-				f->apu.tri_timer = ((f->apu.tri_timer << 3) | value);
-			}
-			return 0;
+		case 0x4015:
+			apu_run(f->apu, f->cpu->cycles);
+			if (write)
+				apu_write(f->apu, addr, value);
+			else
+				value = apu_read_status(f->apu);
+			famicom_update_apu_irq(f);
+			return write ? 0 : value;
 		case 0x4016:
 			if (write) {
 				if (f->last_4016_write) {
@@ -339,47 +529,79 @@ byte mmap_famicom(Famicom* f, word addr, byte value, bool write)
 				return 0;
 			}
 		case 0x4017:
+			// reads are the second controller
+			if (write) {
+				apu_run(f->apu, f->cpu->cycles);
+				apu_write(f->apu, addr, value);
+				famicom_update_apu_irq(f);
+			}
 			return 0;
 		default:
+			if (write && addr <= 0x4013) {
+				apu_run(f->apu, f->cpu->cycles);
+				apu_write(f->apu, addr, value);
+				famicom_update_apu_irq(f);
+			}
 			return 0;
 		}
 		return 0;
 	// cartridge
 	} else if (unmapped_addr_start < addr) {
+		if (write)
+			f->bus_effects++;
+		// prg ram is in the same place for every mapper so far
+		if (0x6000 <= addr && addr < 0x8000) {
+			if (f->prg_ram == NULL)
+				return 0;
+			int i = (addr - 0x6000) % f->prg_ram_size;
+			if (!write)
+				return f->prg_ram[i];
+			if (f->prg_ram[i] != value) {
+				f->prg_ram[i] = value;
+				f->prg_ram_dirty = true;
+			}
+			return 0;
+		}
 		switch(f->loaded_rom.mapper) {
 		default:
 		case 0:
-			int offset;
-			if (f->prg_size == 16384) {
-				offset = 0xC000;
-			} else if (f->prg_size == 32768) {
-				offset = 0x8000;
-			}
+			// 16k roms are mirrored into both halves
 			if (0x7FFF < addr && addr <= 0xFFFF) {
 				if (write)
 					return 0;
-				if (f->prg_size == 16384) {
-					return f->prg[(addr - offset) % f->prg_size];
-				} else if (f->prg_size == 32768) {
-					return f->prg[(addr - offset) % f->prg_size];
-				}
+				return f->prg[(addr - 0x8000) % f->prg_size];
 			}
 			break;
 		case 2:
 			if (0x8000 <= addr && addr <= 0xFFFF) {
-				if (write)
+				if (write) {
+					// bus conflict, the rom drives the data bus too
+					int bank = (value & mmap_famicom(f, addr, 0, false)) % (f->prg_size / 16384);
+					if (bank != f->prg_bank) {
+						f->prg_bank = bank;
+						famicom_invalidate_decode_cache(f, 0x80, 0xBF);
+					}
 					return 0;
-				return f->prg[(addr) - 0xC000];
+				}
+				if (addr < 0xC000)
+					return f->prg[f->prg_bank * 16384 + (addr - 0x8000)];
+				return f->prg[f->prg_size - 16384 + (addr - 0xC000)];
 			} else {
 				return 0;
 			}
 			break;
 		case 3:
 			if (0x8000 <= addr && addr <= 0xFFFF) {
-				if (write) {
-					memcpy(f->chr_window, f->chr + ((value & f->prg[addr - 0x8000]) & 0x03) * 8192, 8192);
+				if (write && f->chr_size != 0) {
+					int bank = (value & f->prg[(addr - 0x8000) % f->prg_size]) & 0x03;
+					byte* chr = f->chr + bank % (f->chr_size / 8192) * 8192;
+					// games often select the bank they already have, that leaves the ppu's cache alone
+					if (f->ppu->pattern[0] != chr) {
+						famicom_ppu_catch_up(f);
+						ppu_set_chr(f->ppu, chr, false);
+					}
 				}
-				return f->prg[(addr) - 0x8000];
+				return f->prg[(addr - 0x8000) % f->prg_size];
 			} else {
 				return 0;
 			}
@@ -389,15 +611,12 @@ byte mmap_famicom(Famicom* f, word addr, byte value, bool write)
 	return 0;
 }
 
+// copies a page to oam through OAMDATA, so it starts at OAMADDR
 void oamdma(Famicom* f, byte value)
 {
-	int i = (value << 8);
-	for (int oam_i=0; oam_i<64; oam_i++) {
-		for (int ii=0; ii<4; ii++) {
-			f->ppu->oam[oam_i][ii] = mmap_famicom(f, i+ii, 0, false);
-		}
-		i += 4;
-	}
+	word page = value << 8;
+	for (int i=0; i<256; i++)
+		ppu_write_register(f->ppu, OAMDATA, mmap_famicom(f, page + i, 0, false));
 }
 
 byte mmap_famicom_read ( Famicom* famicom, word addr )
@@ -410,47 +629,104 @@ void mmap_famicom_write(Famicom *famicom, word addr, byte value)
 	mmap_famicom(famicom, addr, value, true);
 }
 
+// where the cpu went the last time it jumped a short way back
+typedef struct famicom_idle {
+	bool valid;
+	word pc;
+	byte reg[5]; // reg_p is the whole of p
+	uint64_t cycles;
+	int done; // instructions into the step
+	unsigned long bus_effects;
+} Famicom_idle;
+
+// called when the cpu has jumped a short way back. if it's where it went last
+// time, with the same registers and nothing written or read with a side effect
+// since, every pass through the loop will be the same as the last one until
+// something outside the cpu changes. the passes are skipped, up to the end of
+// the step or the next event, and the number of instructions skipped returned.
+static int famicom_skip_idle(Famicom* f, Famicom_idle* idle, int done, int budget)
+{
+	Cpu_6502* cpu = f->cpu;
+	byte reg[5];
+	int skipped = 0;
+	memcpy(reg, cpu->reg, sizeof(reg));
+	reg[reg_p] = cpu_get_p(cpu);
+	if (idle->valid && idle->pc == cpu->pc && idle->bus_effects == f->bus_effects
+	    && memcmp(idle->reg, reg, sizeof(reg)) == 0 && !cpu_interrupt_possible(cpu)
+	    && cpu->cycles < f->next_event) {
+		uint64_t period = cpu->cycles - idle->cycles;
+		int instructions = done - idle->done;
+		uint64_t passes = (budget - done) / instructions;
+		if ((f->next_event - cpu->cycles) / period < passes)
+			passes = (f->next_event - cpu->cycles) / period;
+		cpu->cycles += passes * period;
+		skipped = passes * instructions;
+		f->cycles += skipped;
+	}
+	idle->valid = true;
+	idle->pc = cpu->pc;
+	memcpy(idle->reg, reg, sizeof(reg));
+	idle->cycles = cpu->cycles;
+	idle->done = done + skipped;
+	idle->bus_effects = f->bus_effects;
+	return skipped;
+}
+
 void famicom_step(Famicom* famicom, int cycles, bool debug, FILE* dfh)
 {
 	System system; system.s = famicom_system; system.h = famicom;
-	Instruction i;
-	byte oper1;
-	byte oper2;
-	byte oper[2];
-	for (int c=0; c<cycles; c++) {
+	Famicom_idle idle;
+	idle.valid = false;
+	for (int c=0; c<cycles; ) {
+		word pc = famicom->cpu->pc;
 		famicom->debug.nmi = false;
-		famicom->cpu->branch_taken = false;
-		i = parse(mmap_famicom(famicom, famicom->cpu->pc, 0, false));
-		if (i.n == unimplemented) {
-			printf("unimplemented opcode %X!\n", mmap_famicom_read(famicom, famicom->cpu->pc));
-			famicom->cpu->running = false;
-			return;
+		famicom->debug.irq = false;
+		// an interrupt found by the last instruction's poll is taken in place of
+		// the next one. a translated block is only used when all of its
+		// instructions fit, jit_run() leaves them to us while one could come in.
+		if (famicom->apu_event <= famicom->cpu->cycles + FAMICOM_IRQ_LEAD)
+			famicom_update_apu_irq(famicom);
+		int ran = 0;
+		if (famicom->cpu->interrupt != interrupt_none) {
+			famicom->debug.nmi = famicom->cpu->interrupt == interrupt_nmi;
+			famicom->debug.irq = famicom->cpu->interrupt == interrupt_irq;
+			famicom_cpu_interrupt(famicom, famicom->cpu);
+			ran = 1;
+		} else if (famicom->jit != NULL && !debug) {
+			// blocks can't stop for an apu irq or the ppu, so they're kept
+			// short of the next event. no instruction takes as long as
+			// FAMICOM_IRQ_LEAD.
+			uint64_t budget = cycles - c;
+			if (famicom->next_event != UINT64_MAX) {
+				uint64_t until = famicom->next_event <= famicom->cpu->cycles ? 0
+				    : (famicom->next_event - famicom->cpu->cycles) / FAMICOM_IRQ_LEAD;
+				if (until < budget)
+					budget = until;
+			}
+			if (budget != 0)
+				ran = jit_run(famicom->jit, system, famicom->cpu, budget);
 		}
-		oper1 = mmap_famicom(famicom, famicom->cpu->pc + 1, 0, false);
-		oper2 = 0;
-		switch (i.a) {
-		default:
-			break;
-		case absolute:
-		case absolute_indirect:
-		case absolute_x:
-		case absolute_y:
-			oper2 = mmap_famicom(famicom, famicom->cpu->pc + 2, 0, false);
-			break;
+		if (ran == 0) {
+			Decoded_instruction* d = famicom_decode_cached(famicom);
+			if (d != NULL) {
+				famicom_cpu_execute(famicom, famicom->cpu, d);
+			} else {
+				famicom_cpu_step(famicom, famicom->cpu);
+			}
+			ran = 1;
 		}
-		oper[0] = oper1;
-		oper[1] = oper2;
-		//printf("%s %X %X pc: %X sp: %X\n", i.m, oper1, oper2, famicom->cpu->pc, famicom->cpu->reg[reg_sp]);
-		step(system, famicom->cpu, i, oper);
+		if (!famicom->cpu->running)
+			return;
 
 		if (debug)
 			write_cpu_state(famicom->cpu, system, dfh);
-		famicom->cycles++;
-		if (famicom->ppu->vblank_flag && famicom->ppu->nmi_enable) {
-			nmi(system, famicom->cpu);
-			famicom->ppu->nmi_enable = false;
-			famicom->ppu->vblank_flag = false;
-			famicom->debug.nmi = true;
-		}
+		c += ran;
+		famicom->cycles += ran;
+		if (famicom->skip_idle && !debug && famicom->cpu->pc <= pc && pc - famicom->cpu->pc <= FAMICOM_IDLE_LOOP)
+			c += famicom_skip_idle(famicom, &idle, c, cycles);
+		if (famicom->ppu_event <= famicom->cpu->cycles)
+			break;
 	}
+	apu_run(famicom->apu, famicom->cpu->cycles);
+	famicom_update_apu_irq(famicom);
 }
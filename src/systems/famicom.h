@@ -3,18 +3,22 @@ typedef struct famicom_debug {
 	bool irq;
 } Famicom_debug;
 
+#define FAMICOM_IDLE_LOOP 16 // bytes, the furthest back a jump can go and still be an idle loop
+#define FAMICOM_IRQ_LEAD 8 // cycles, more than the longest instruction
+
+// the devices that can hold the cpu's irq line, each has its bit in irq_lines
+enum famicom_irq_source {
+	famicom_irq_apu_frame = 0x01,
+	famicom_irq_dmc = 0x02,
+	famicom_irq_mapper = 0x04,
+};
+
 typedef struct famicom_rom {
 	char* name;
 	int mapper;
 	int mirroring;
 } Famicom_rom;
 
-typedef struct famicom_apu {
-	word pulse1_timer;
-	word pulse2_timer;
-	word tri_timer;
-} Famicom_apu;
-
 enum famicom_joypad_buttons {
 	joypad_a,
 	joypad_b,
@@ -40,18 +44,49 @@ typedef struct famicom_controller {
 typedef struct famicom {
 	Cpu_6502* cpu;
 	Famicom_ppu* ppu;
-	Famicom_apu apu;
+	Famicom_apu* apu;
 	Famicom_debug debug;
 	Famicom_rom loaded_rom;
 	int cycles;
 	int prg_size;
 	int chr_size;
 	byte* mem;
+	// prg and chr rom are in rom, which other famicoms can be running from too
+	struct rom_image* rom;
 	byte* prg;
 	byte* prg_window;
 	byte* chr;
-	byte* chr_window;
+	bool chr_ram; // chr is the famicom's own
+	// at $6000-$7FFF, NULL if the cart has none. prg_ram_dirty is set by
+	// writes that change it, and cleared by whoever's saving it.
+	byte* prg_ram;
+	int prg_ram_size;
+	bool prg_ram_dirty;
 	byte oam[64][4];
+	int prg_bank;
+	// decoded instructions for each page of prg rom and internal ram, allocated
+	// the first time code runs from the page. ram mirrors share their entries.
+	Decoded_instruction* decode_cache[256];
+	int ram_decode_pages;
+	// only set when famicom_enable_jit() was called, prg rom is translated
+	struct jit* jit;
+	// loops that only wait for something to change are skipped over, see
+	// famicom_skip_idle(). bus_effects counts the accesses that change something,
+	// next_event is the cpu cycle of the next thing a device does by itself.
+	bool skip_idle;
+	unsigned long bus_effects;
+	uint64_t next_event;
+	// the cycle of the ppu's next event, see ppu_next_event(). a step stops
+	// once it gets there. UINT64_MAX while the ppu isn't being run.
+	uint64_t ppu_event;
+	// famicom_run_frame() runs the ppu in chunks up to its next event, and
+	// catches it up whenever the cpu touches it. ppu_cycle is the cpu cycle
+	// it's been run up to.
+	uint64_t ppu_cycle;
+	// the apu is only run when it's read or written, or at the end of a step.
+	// its irqs are put on the line ahead of time, see famicom_update_apu_irq().
+	// apu_event is the cycle of the next one that isn't on the line yet.
+	uint64_t apu_event;
 	Famicom_controller controller_p1;
 	Famicom_controller controller_p2;
 	bool last_4016_write;
@@ -64,4 +99,20 @@ void famicom_reset (Famicom* famicom, bool warm);
 void famicom_destroy (Famicom* famicom);
 void famicom_step(Famicom* famicom, int cycles, bool debug, FILE* dfh);
 int  famicom_load_rom (Famicom* famicom, FILE* rom);
+int famicom_attach_rom(Famicom* famicom, struct rom_image* image);
+void famicom_print_rom(struct rom_image* image);
 byte mmap_famicom(Famicom* f, word addr, byte value, bool write);
+void famicom_invalidate_decode_cache(Famicom* f, int first_page, int last_page);
+bool famicom_enable_jit(Famicom* f);
+void famicom_set_vblank(Famicom* f, bool vblank);
+void famicom_ppu_tick(Famicom* f);
+void famicom_run_frame(Famicom* f, bool debug, FILE* dfh);
+void famicom_set_button(Famicom_controller* c, int button, bool pressed);
+void famicom_set_buttons(Famicom_controller* c, byte buttons);
+void famicom_update_apu_irq(Famicom* f);
+void famicom_update_next_event(Famicom* f);
+void famicom_cpu_reset(Famicom* f, Cpu_6502* cpu);
+void famicom_cpu_interrupt(Famicom* f, Cpu_6502* cpu);
+void famicom_cpu_decode(Famicom* f, Cpu_6502* cpu, Decoded_instruction* d);
+void famicom_cpu_execute(Famicom* f, Cpu_6502* cpu, Decoded_instruction* d);
+void famicom_cpu_step(Famicom* f, Cpu_6502* cpu);
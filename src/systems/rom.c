@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../types.h"
+#include "system.h"
+#include "../chips/2C02.h"
+#include "rom.h"
+
+static uint64_t rom_hash(byte* data, long size)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for (long i=0; i<size; i++)
+		hash = (hash ^ data[i]) * 0x100000001B3ULL;
+	return hash;
+}
+
+static void rom_free(Rom_image* image)
+{
+	free(image->name);
+	if (image->mapped)
+		munmap(image->data, image->size);
+	else
+		free(image->data);
+	free(image);
+}
+
+// a nes 2.0 rom size, from the lsb in the old field and the msb nibble. an msb
+// of F means the lsb is 2^E * (M*2 + 1), for sizes that aren't whole banks.
+static uint64_t rom_nes2_size(byte lsb, byte msb, int bank)
+{
+	if (msb == 0x0F) {
+		if (lsb >> 2 > 30)
+			return UINT64_MAX;
+		return ((uint64_t)1 << (lsb >> 2)) * ((lsb & 0x03) * 2 + 1);
+	}
+	return (uint64_t)(msb << 8 | lsb) * bank;
+}
+
+// nes 2.0 gives ram sizes as shift counts, 64 << n bytes or none for 0
+static int rom_nes2_ram(byte shift)
+{
+	return shift == 0 ? 0 : 64 << shift;
+}
+
+// works out where everything is from the header, returns 1 if it isn't an
+// ines rom or is shorter than its header says
+static int rom_parse(Rom_image* image)
+{
+	byte* h = image->data;
+	if (image->size < ROM_HEADER || h[0] != 'N' || h[1] != 'E' || h[2] != 'S' || h[3] != 0x1A) {
+		printf("not an NES rom\n");
+		return 1;
+	}
+	uint64_t prg_size, chr_size;
+	image->nes2 = (h[7] & 0x0C) == 0x08;
+	image->mirroring = h[6] & 0x08 ? mirroring_four_screen : h[6] & 0x01;
+	image->battery = h[6] & 0x02;
+	if (image->nes2) {
+		image->mapper = (h[8] & 0x0F) << 8 | (h[7] & 0xF0) | h[6] >> 4;
+		image->submapper = h[8] >> 4;
+		prg_size = rom_nes2_size(h[4], h[9] & 0x0F, ROM_PRG_BANK);
+		chr_size = rom_nes2_size(h[5], h[9] >> 4, ROM_CHR_BANK);
+		image->prg_nvram_size = rom_nes2_ram(h[10] >> 4);
+		image->prg_ram_size = rom_nes2_ram(h[10] & 0x0F) + image->prg_nvram_size;
+		image->chr_ram_size = rom_nes2_ram(h[11] & 0x0F) + rom_nes2_ram(h[11] >> 4);
+	} else {
+		// tools used to sign their name over bytes 7-15, which leaves junk in
+		// the mapper's high nibble. a real ines 1.0 header has zeros at the end.
+		bool junk = (h[7] & 0x0C) == 0x04 || h[12] || h[13] || h[14] || h[15];
+		image->mapper = (junk ? 0 : h[7] & 0xF0) | h[6] >> 4;
+		image->submapper = 0;
+		prg_size = (uint64_t)h[4] * ROM_PRG_BANK;
+		chr_size = (uint64_t)h[5] * ROM_CHR_BANK;
+		image->prg_ram_size = junk || h[8] == 0 ? ROM_PRG_RAM : h[8] * ROM_PRG_RAM;
+		image->prg_nvram_size = image->battery ? image->prg_ram_size : 0;
+		image->chr_ram_size = chr_size == 0 ? ROM_CHR_BANK : 0;
+	}
+	if (prg_size == 0) {
+		printf("rom has no prg\n");
+		return 1;
+	}
+	if (prg_size > INT_MAX || chr_size > INT_MAX) {
+		printf("rom says it's bigger than it can be\n");
+		return 1;
+	}
+	uint64_t trainer = h[6] & 0x04 ? ROM_TRAINER : 0;
+	uint64_t size = ROM_HEADER + trainer + prg_size + chr_size;
+	if ((uint64_t)image->size < size) {
+		printf("rom is shorter than its header says, %ld bytes of %llu\n", image->size, (unsigned long long)size);
+		return 1;
+	}
+	image->prg_size = prg_size;
+	image->chr_size = chr_size;
+	image->trainer = trainer ? image->data + ROM_HEADER : NULL;
+	image->prg = image->data + ROM_HEADER + trainer;
+	image->chr = image->prg + prg_size;
+	return 0;
+}
+
+// reads everything in f after where it is into data, returns its size or -1
+static long rom_read_stream(FILE* f, byte** data)
+{
+	long size = 0, capacity = 0;
+	*data = NULL;
+	for (;;) {
+		if (size == capacity) {
+			capacity = capacity ? capacity * 2 : 65536;
+			byte* grown = realloc(*data, capacity);
+			if (grown == NULL) {
+				free(*data);
+				*data = NULL;
+				return -1;
+			}
+			*data = grown;
+		}
+		size_t got = fread(*data + size, 1, capacity - size, f);
+		size += got;
+		if (got == 0 || ferror(f))
+			break;
+	}
+	if (ferror(f)) {
+		free(*data);
+		*data = NULL;
+		return -1;
+	}
+	return size;
+}
+
+// makes an image of its own from f and closes it. a regular file is mapped
+// whole, anything else, like a pipe, is read from where it's got to.
+Rom_image* rom_read(FILE* f, char* name)
+{
+	Rom_image* image = calloc(1, sizeof(Rom_image));
+	if (image == NULL) {
+		printf("couldn't allocate memory\n");
+		fclose(f);
+		return NULL;
+	}
+	image->name = strdup(name);
+	struct stat st;
+	int fd = fileno(f);
+	if (fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && 0 < st.st_size && st.st_size <= LONG_MAX) {
+		void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			image->data = data;
+			image->size = st.st_size;
+			image->mapped = true;
+		}
+	}
+	if (!image->mapped) {
+		image->size = rom_read_stream(f, &image->data);
+		if (image->size < 0) {
+			printf("couldn't read %s\n", name);
+			fclose(f);
+			rom_free(image);
+			return NULL;
+		}
+	}
+	fclose(f);
+	image->hash = rom_hash(image->data, image->size);
+	image->refs = 1;
+	if (image->name == NULL || rom_parse(image) == 1) {
+		rom_free(image);
+		return NULL;
+	}
+	return image;
+}
+
+void rom_cache_init(Rom_cache* cache)
+{
+	pthread_mutex_init(&cache->lock, NULL);
+	cache->images = NULL;
+}
+
+// only once nothing is using its images
+void rom_cache_destroy(Rom_cache* cache)
+{
+	while (cache->images != NULL) {
+		Rom_image* next = cache->images->next;
+		rom_free(cache->images);
+		cache->images = next;
+	}
+	pthread_mutex_destroy(&cache->lock);
+}
+
+static Rom_image* rom_find(Rom_cache* cache, char* name, Rom_image* same)
+{
+	for (Rom_image* image=cache->images; image!=NULL; image=image->next) {
+		if (name != NULL && strcmp(image->name, name) == 0)
+			return image;
+		if (same != NULL && image->hash == same->hash && image->size == same->size
+		    && memcmp(image->data, same->data, same->size) == 0)
+			return image;
+	}
+	return NULL;
+}
+
+// the image for filename, loaded if no other file with the same contents has
+// been. with a NULL cache the image is the caller's own.
+Rom_image* rom_load(Rom_cache* cache, char* filename)
+{
+	Rom_image* image;
+	if (cache != NULL) {
+		pthread_mutex_lock(&cache->lock);
+		image = rom_find(cache, filename, NULL);
+		if (image != NULL)
+			image->refs++;
+		pthread_mutex_unlock(&cache->lock);
+		if (image != NULL)
+			return image;
+	}
+	FILE* f = fopen(filename, "rb");
+	if (f == NULL) {
+		printf("couldn't open %s\n", filename);
+		return NULL;
+	}
+	// read without the lock held, another thread may load the same one meanwhile
+	Rom_image* loaded = rom_read(f, filename);
+	if (loaded == NULL || cache == NULL)
+		return loaded;
+	pthread_mutex_lock(&cache->lock);
+	image = rom_find(cache, NULL, loaded);
+	if (image != NULL) {
+		image->refs++;
+		rom_free(loaded);
+	} else {
+		image = loaded;
+		image->cache = cache;
+		image->next = cache->images;
+		cache->images = image;
+	}
+	pthread_mutex_unlock(&cache->lock);
+	return image;
+}
+
+// a cached image stays loaded until the cache is destroyed, in case it's
+// wanted again
+void rom_release(Rom_image* image)
+{
+	if (image == NULL)
+		return;
+	if (image->cache == NULL) {
+		if (--image->refs == 0)
+			rom_free(image);
+		return;
+	}
+	pthread_mutex_lock(&image->cache->lock);
+	image->refs--;
+	pthread_mutex_unlock(&image->cache->lock);
+}
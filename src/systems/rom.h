@@ -0,0 +1,47 @@
+// ines rom images, read once and shared. the prg and chr in an image are only
+// ever read, so any number of famicoms can run from the same one. a cache
+// hands out the image already loaded for a file, or one with the same
+// contents under another name, and counts the famicoms using each.
+// files are mapped rather than read where they can be, so the pages of a rom
+// are shared with the page cache and only read in when they're used.
+
+#define ROM_HEADER 16
+#define ROM_PRG_BANK 16384
+#define ROM_CHR_BANK 8192
+#define ROM_TRAINER 512
+#define ROM_PRG_RAM 8192 // what an ines 1.0 rom that says 0 has
+
+typedef struct rom_image {
+	char* name; // of the file it was loaded from first
+	uint64_t hash; // fnv-1a of the whole file
+	byte* data; // the whole file
+	long size;
+	bool mapped; // data is mmapped, not allocated
+	bool nes2; // the header's in the nes 2.0 format
+	int mapper;
+	int submapper; // only nes 2.0 headers have one
+	int mirroring;
+	bool battery; // the prg ram, or whatever the mapper keeps, is saved
+	byte* trainer; // 512 bytes for $7000, or NULL
+	byte* prg;
+	int prg_size;
+	byte* chr;
+	int chr_size; // 0 when the cart has chr ram instead
+	int prg_ram_size; // including prg_nvram_size
+	int prg_nvram_size; // of it, what the battery keeps
+	int chr_ram_size;
+	int refs; // under the cache's lock
+	struct rom_cache* cache; // NULL for an image of its own
+	struct rom_image* next;
+} Rom_image;
+
+typedef struct rom_cache {
+	pthread_mutex_t lock;
+	Rom_image* images;
+} Rom_cache;
+
+void rom_cache_init(Rom_cache* cache);
+void rom_cache_destroy(Rom_cache* cache);
+Rom_image* rom_read(FILE* f, char* name);
+Rom_image* rom_load(Rom_cache* cache, char* filename);
+void rom_release(Rom_image* image);
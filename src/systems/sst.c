@@ -1,16 +1,31 @@
 #include <stdio.h>
+#include <string.h>
 #include "../types.h"
 #include "../bitmath.h"
 #include "system.h"
 #include "../chips/6502.h"
 #include "sst.h"
 
+#define CORE_MACHINE Sst
+#define CORE_BUS mmap_sst
+#define CORE_PREFIX sst_cpu_
+#define CORE_DECIMAL
+#include "../chips/6502_core.h"
+
 byte mmap_sst(Sst* s, word addr, byte value, bool write)
 {
+	if (!write)
+		value = s->ram[addr];
+	if (s->cycle_count < SST_MAX_CYCLES) {
+		s->cycles[s->cycle_count].addr = addr;
+		s->cycles[s->cycle_count].value = value;
+		s->cycles[s->cycle_count].write = write;
+	}
+	s->cycle_count++;
 	if (write) {
 		s->ram[addr] = value;
 		return 0;
 	} else {
-		return s->ram[addr];
+		return value;
 	}
 }
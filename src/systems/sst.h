@@ -1,6 +1,22 @@
 //psuedo system for running single step tests
+#define SST_MAX_CYCLES 32
+
+typedef struct sst_cycle {
+	word addr;
+	byte value;
+	bool write;
+} Sst_cycle;
+
 typedef struct sst {
 	Cpu_6502* cpu;
-	char ram[0x10000];
+	byte ram[0x10000];
+	// every bus access is logged so tests can check cycle counts and dummy accesses
+	Sst_cycle cycles[SST_MAX_CYCLES];
+	int cycle_count;
 } Sst;
 byte mmap_sst(Sst* s, word addr, byte value, bool write);
+void sst_cpu_reset(Sst* s, Cpu_6502* cpu);
+void sst_cpu_interrupt(Sst* s, Cpu_6502* cpu);
+void sst_cpu_decode(Sst* s, Cpu_6502* cpu, Decoded_instruction* d);
+void sst_cpu_execute(Sst* s, Cpu_6502* cpu, Decoded_instruction* d);
+void sst_cpu_step(Sst* s, Cpu_6502* cpu);